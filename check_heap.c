@@ -3,9 +3,149 @@
 #include "csbrk.h"
 
 //Place any variables needed here from umalloc.c or csbrk.c as an extern.
-extern memory_block_t *free_head;
+extern arena_t arenas[MAX_ARENAS];
+extern int num_arenas;
 extern sbrk_block *sbrk_blocks;
 
+/*
+ * check_span - checks through the page map that the block at start, size bytes
+ * long, lies inside a single region of the heap.
+ */
+static int check_span(uint64_t start, uint64_t size){
+    span_t *span = page_span((void *)start);
+    if(span == NULL || span->kind != SPAN_REGION){
+        return -1;
+    }
+    if(start < span->start || start + size > span->end){
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * check_free_block - checks that a block found through the free structures is
+ * marked free, has a sensible size and lies within a valid heap address range.
+ */
+static int check_free_block(memory_block_t *cur) {
+    //if free block is marked as allocated returns error flag
+    if(is_allocated(cur)){
+        return -1;
+    }
+    if(!is_memory_block(cur)){
+        return -1;
+    }
+    if(get_size(cur) < MIN_BLOCK_SIZE){
+        return -1;
+    }
+    //The page map knows which region the block starts in
+    return check_span((uint64_t)cur, (uint64_t)get_size(cur));
+}
+
+/*
+ * check_slab - checks a slab run on its arena's list for class cls: its page
+ * must map to it, it must lie inside the region it maps back to, have the
+ * class's object size, and count exactly as many free slots as its bitmap marks.
+ */
+static int check_slab(slab_t *run, int cls, int arena_id){
+    if(find_slab(run) != run || run->span.arena_id != arena_id){
+        return -1;
+    }
+    if(run->obj_size != (cls + 1) * ALIGNMENT || run->nslots != (SLAB_RUN_SIZE - SLAB_HEADER) / run->obj_size){
+        return -1;
+    }
+    if(run->region == NULL || run->region->kind != SPAN_REGION || run->region->arena_id != arena_id){
+        return -1;
+    }
+    if(run->span.start < run->region->start || run->span.end > run->region->end){
+        return -1;
+    }
+    int nfree = 0;
+    for(int word = 0; word < SLAB_BITMAP_WORDS; word++){
+        nfree += __builtin_popcountll(run->bitmap[word]);
+    }
+    if(nfree != run->nfree || nfree == 0 || nfree > run->nslots){
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * check_tree - checks every node of the best fit tree, and that each subtree
+ * stays strictly between the (size, address) bounds set by its ancestors.
+ */
+static int check_tree(memory_block_t *node, memory_block_t *lo, memory_block_t *hi) {
+    if(node == NULL){
+        return 0;
+    }
+    if(check_free_block(node) != 0 || get_size(node) < TREE_MIN_SIZE){
+        return -1;
+    }
+    if(lo && (get_size(lo) > get_size(node) || (get_size(lo) == get_size(node) && lo >= node))){
+        return -1;
+    }
+    if(hi && (get_size(node) > get_size(hi) || (get_size(node) == get_size(hi) && node >= hi))){
+        return -1;
+    }
+    if(check_tree(tree_left(node), lo, node) != 0){
+        return -1;
+    }
+    return check_tree(tree_right(node), node, hi);
+}
+
+/*
+ * check_region - walks one region from the prologue sentinel that opens it to
+ * the epilogue sentinel that closes it, checking that no two blocks overlap or
+ * leave the region and that all blocks are 16 byte aligned. Also checks the
+ * boundary tags: free blocks have a matching footer, the PREV_ALLOC bit agrees
+ * with the block before, and no two free blocks are left next to each other.
+ * Allocated blocks must name one of the arenas in use, and every block must lie
+ * inside the region the page map has for its first byte.
+ */
+static int check_region(span_t *region){
+    memory_block_t *prologue = (memory_block_t *)region->start;
+    if(!is_allocated(prologue) || get_size(prologue) != 0){
+        return -1;
+    }
+    uint64_t start = region->start + PROLOGUE_SIZE;
+    uint64_t last = region->end - EPILOGUE_SIZE;
+    memory_block_t *header = (memory_block_t *)start;
+    bool prev_alloc = true;
+    while(start < last){
+        if(!is_memory_block(header) || get_size(header) == 0){
+            return -1;
+        }
+        uint64_t end = start + (uint64_t)get_size(header);
+        if(get_size(header) % ALIGNMENT != 0){
+            return -1;
+        }
+        if(is_prev_alloc(header) != prev_alloc){
+            return -1;
+        }
+        if(end > last || check_span(start, end - start) != 0){
+            return -1;
+        }
+        if(is_allocated(header) && (int)(header->block_size_alloc >> ARENA_SHIFT) >= num_arenas){
+            return -1;
+        }
+        if(!is_allocated(header)){
+            if(!prev_alloc){
+                return -1;
+            }
+            if(*((size_t *)end - 1) != get_size(header)){
+                return -1;
+            }
+        }
+        prev_alloc = is_allocated(header);
+        header = (memory_block_t *)end;
+        start = end;
+    }
+    //the epilogue, which must end the region exactly
+    if(start != last || !is_memory_block(header) || !is_allocated(header) || get_size(header) != 0){
+        return -1;
+    }
+    return is_prev_alloc(header) == prev_alloc ? 0 : -1;
+}
+
 /*
  * check_heap -  used to check that the heap is still in a consistent state.
  
@@ -33,66 +173,141 @@ int check_heap() {
         }
     */
 
-   //Checks that all free blocks are in valid memory adresses and that all free blocks
-   //are allocated as free
-   memory_block_t *cur = free_head;
-   while(cur){
-       //if free block is marked as allocated returns error flag
-       if(is_allocated(cur)){
-           return -1;
+   //Every arena keeps its own free structures and regions, checked one after the other
+   uint64_t region_total = 0;
+   for(int i = 0; i < num_arenas; i++){
+       arena_t *arena = &arenas[i];
+       if(!arena->initialized){
+           continue;
+       }
+       //Checks that all free blocks are in valid memory adresses, that all free blocks
+       //are allocated as free, that each one sits on the list for its size class
+       //and that the back links agree with the forward links
+       for(int cls = 0; cls < NUM_CLASSES; cls++){
+           memory_block_t *cur = arena->free_lists[cls];
+           memory_block_t *prev = NULL;
+           while(cur){
+               if(check_free_block(cur) != 0){
+                   return -1;
+               }
+               if(get_class(get_size(cur)) != cls){
+                   return -1;
+               }
+               if(get_prev(cur) != prev){
+                   return -1;
+               }
+               prev = cur;
+               cur = cur->next;
+           }
        }
-       if(!is_memory_block(cur)){
+
+       //Same for the TLSF lists, which must also agree with both levels of bitmaps
+       for(int fl = 0; fl < TLSF_FL_COUNT; fl++){
+           if(((arena->tlsf_fl_bitmap >> fl) & 1) != (arena->tlsf_sl_bitmap[fl] != 0)){
+               return -1;
+           }
+           for(int sl = 0; sl < TLSF_SL_COUNT; sl++){
+               memory_block_t *cur = arena->tlsf_lists[fl][sl];
+               memory_block_t *prev = NULL;
+               if(((arena->tlsf_sl_bitmap[fl] >> sl) & 1) != (cur != NULL)){
+                   return -1;
+               }
+               while(cur){
+                   int cur_fl, cur_sl;
+                   if(check_free_block(cur) != 0){
+                       return -1;
+                   }
+                   tlsf_mapping(get_size(cur), &cur_fl, &cur_sl);
+                   if(cur_fl != fl || cur_sl != sl){
+                       return -1;
+                   }
+                   if(get_prev(cur) != prev){
+                       return -1;
+                   }
+                   prev = cur;
+                   cur = cur->next;
+               }
+           }
+       }
+
+       //The best fit tree only holds blocks that are too large for the exact classes
+       if(check_tree(arena->free_tree, NULL, NULL) != 0){
            return -1;
        }
-       sbrk_block *sbcur = sbrk_blocks;
-       bool passed = false;
-       uint64_t start = (uint64_t)cur;
-       uint64_t end = start + (uint64_t)get_size(cur);
-
-       //Iterates through sbrk blocks to check if free block is within a valid
-       //heap address
-       while(sbcur){
-           if(start >= sbcur->sbrk_start && end <= sbcur->sbrk_end){
-               passed = true;
-               break;
+
+       //Blocks on the quick lists were freed but not yet coalesced, so they are still marked
+       //allocated, and each sits on the list for its exact size
+       size_t quick_bytes = 0;
+       for(int bin = 0; bin < QUICK_BINS; bin++){
+           for(memory_block_t *cur = arena->quick_lists[bin]; cur != NULL; cur = cur->next){
+               if(!is_memory_block(cur) || !is_allocated(cur)){
+                   return -1;
+               }
+               if(get_size(cur) != MIN_BLOCK_SIZE + (size_t)bin * ALIGNMENT){
+                   return -1;
+               }
+               if(check_span((uint64_t)cur, (uint64_t)get_size(cur)) != 0){
+                   return -1;
+               }
+               quick_bytes += get_size(cur);
            }
-           sbcur = sbcur->next;
        }
-       if(!passed){
+       if(quick_bytes != arena->quick_bytes){
            return -1;
        }
-       cur = cur->next;
-   }
 
-   //Iterates through each block of memory checking that no two blocks are overlapping, 
-   //extending pass the end of the arena of memory it is in, and that all blocks are 16 byte aligned
-   sbrk_block *arena = sbrk_blocks;
-   while(arena != NULL){
-       memory_block_t *header = (memory_block_t *)arena->sbrk_start;
-       uint64_t start = arena->sbrk_start;
-       if(!is_memory_block(header)){
+       //Slab runs with free slots, each on the list of its own class with matching back links
+       for(int cls = 0; cls < SLAB_CLASSES; cls++){
+           slab_t *prev = NULL;
+           for(slab_t *run = arena->slabs[cls]; run != NULL; run = run->next){
+               if(check_slab(run, cls, i) != 0 || run->prev != prev){
+                   return -1;
+               }
+               prev = run;
+           }
+       }
+
+       //The arena's regions, newest first, each lying within one tracked sbrk range. The
+       //newest is the one that grows, so it must end where the arena's heap does.
+       if(arena->region == NULL || arena->region->end != (uint64_t)arena->heap_end){
            return -1;
        }
-       uint64_t end = start + (uint64_t)get_size(header);
-       while(start >= arena->sbrk_start && start < arena->sbrk_end){
-           if(!is_memory_block(header)){
+       for(span_t *region = arena->region; region != NULL; region = region->next){
+           if(region->kind != SPAN_REGION || region->arena_id != i){
                return -1;
            }
-           if(end > arena->sbrk_end){
+           if(check_malloc_output((void *)region->start, region->end - region->start) != 0){
                return -1;
            }
-           if(get_size(header) % ALIGNMENT != 0){
+           if(check_region(region) != 0){
                return -1;
            }
-           if(end == arena->sbrk_end){
-               break;
-           }
-           header = (memory_block_t *)end;
-           start = end;
-           end = start + (uint64_t)get_size(header);
-           
+           region_total += region->end - region->start;
        }
-       arena = arena->next;
+   }
+
+   //Every tracked range of sbrk'd memory must be covered by regions, and each large block's
+   //mapping must be described by the span at its start, which all of the mapping's pages lead to
+   uint64_t sbrk_total = 0;
+   for(sbrk_block *sbcur = sbrk_blocks; sbcur != NULL; sbcur = sbcur->next){
+       if(!sbcur->mapped){
+           sbrk_total += sbcur->sbrk_end - sbcur->sbrk_start;
+           continue;
+       }
+       span_t *span = (span_t *)sbcur->sbrk_start;
+       if(span->kind != SPAN_LARGE || span->end != sbcur->sbrk_end){
+           return -1;
+       }
+       if(page_span((void *)span->start) != span || page_span((void *)(sbcur->sbrk_end - 1)) != span){
+           return -1;
+       }
+       memory_block_t *large = (memory_block_t *)span->start;
+       if(!is_memory_block(large) || !is_allocated(large) || get_size(large) != ((span->end - span->start) & ~(uint64_t)(ALIGNMENT - 1))){
+           return -1;
+       }
+   }
+   if(region_total != sbrk_total){
+       return -1;
    }
    
 
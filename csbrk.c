@@ -4,9 +4,26 @@
 #include <assert.h>
 #include <unistd.h>
 #include <stdbool.h>
+#include <sys/mman.h>
 
 sbrk_block *sbrk_blocks = NULL;
 size_t sbrk_bytes;
+#ifdef TRACK_CSBRK
+static size_t footprint;
+
+/*
+ * track_footprint - adds delta to the bytes currently obtained through csbrk()
+ * and cmmap(). sbrk_bytes holds the peak, so memory that is handed back does
+ * not make the utilization score look better than it was.
+ */
+static void track_footprint(intptr_t delta)
+{
+    footprint += delta;
+    if (footprint > sbrk_bytes) {
+        sbrk_bytes = footprint;
+    }
+}
+#endif
 
 void *csbrk(intptr_t increment)
 {
@@ -18,15 +35,21 @@ void *csbrk(intptr_t increment)
     }
 
     void *ret = sbrk(increment);
+    // callers test for NULL, like they do for the request limit above
+    if (ret == (void *)-1)
+    {
+        return NULL;
+    }
 #ifdef TRACK_CSBRK
-    sbrk_bytes += increment;
+    track_footprint(increment);
     uint64_t sbrk_start_temp = (uint64_t)ret;
     uint64_t sbrk_end_temp = sbrk_start_temp + (uint64_t)increment;
     bool coalesced = false;
     sbrk_block *temp = sbrk_blocks;
+    // a negative increment shrinks the range that ends at the old break the same way
     while (temp != NULL)
     {
-        if (temp->sbrk_end == sbrk_start_temp){
+        if (!temp->mapped && temp->sbrk_end == sbrk_start_temp){
             temp->sbrk_end = sbrk_end_temp;
             coalesced = true;
             break;
@@ -38,6 +61,7 @@ void *csbrk(intptr_t increment)
         sbrk_block *temp = malloc(sizeof(sbrk_block));
         temp->sbrk_start = sbrk_start_temp;
         temp->sbrk_end = sbrk_end_temp;
+        temp->mapped = 0;
 
         temp->next = sbrk_blocks;
         sbrk_blocks = temp;
@@ -47,6 +71,54 @@ void *csbrk(intptr_t increment)
     return ret;
 }
 
+/*
+ * cmmap - maps length bytes of fresh memory for a request too large for csbrk().
+ * The mapping is tracked like sbrk'd memory and counts towards sbrk_bytes, so
+ * the utilization score covers it too.
+ */
+void *cmmap(size_t length)
+{
+    void *ret = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (ret == MAP_FAILED) {
+        return NULL;
+    }
+#ifdef TRACK_CSBRK
+    track_footprint(length);
+    sbrk_block *temp = malloc(sizeof(sbrk_block));
+    temp->sbrk_start = (uint64_t)ret;
+    temp->sbrk_end = (uint64_t)ret + (uint64_t)length;
+    temp->mapped = 1;
+
+    temp->next = sbrk_blocks;
+    sbrk_blocks = temp;
+#endif
+
+    return ret;
+}
+
+/*
+ * cmunmap - unmaps memory from cmmap() and stops tracking it.
+ */
+int cmunmap(void *addr, size_t length)
+{
+#ifdef TRACK_CSBRK
+    track_footprint(-(intptr_t)length);
+    sbrk_block **link = &sbrk_blocks;
+    while (*link != NULL)
+    {
+        if ((*link)->mapped && (*link)->sbrk_start == (uint64_t)addr) {
+            sbrk_block *temp = *link;
+            *link = temp->next;
+            free(temp);
+            break;
+        }
+        link = &(*link)->next;
+    }
+#endif
+
+    return munmap(addr, length);
+}
+
 int check_malloc_output(void *payload_start, size_t payload_length)
 {
     uint64_t start_uint = (uint64_t)payload_start;
@@ -18,8 +18,11 @@ typedef struct sbrk_block_struct
 {
     uint64_t sbrk_start;
     uint64_t sbrk_end;
+    int mapped;            /* Set for memory from cmmap() rather than sbrk */
     struct sbrk_block_struct *next;
 } sbrk_block;
 
-void *csbrk(intptr_t increment);
+void *csbrk(intptr_t increment); /* NULL if the increment is over the limit or sbrk fails */
+void *cmmap(size_t length);
+int cmunmap(void *addr, size_t length);
 int check_malloc_output(void *payload_start, size_t payload_length);
\ No newline at end of file
@@ -0,0 +1,121 @@
+/**************************************************************************
+ * C S 429 MM-lab
+ * 
+ * latency.c - Replays a trace and reports the latency distribution of
+ * individual umalloc, urealloc and ufree calls, rather than the total run time
+ * measured by performance.c.
+ **************************************************************************/
+
+#include "umalloc.h"
+#include "support.h"
+
+/*
+ * now_ns - Reads the monotonic clock in nanoseconds.
+ */
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int compare_latency(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+/*
+ * percentile - Returns the p-th percentile of n sorted latencies.
+ */
+static uint64_t percentile(uint64_t *sorted, size_t n, double p) {
+    if (n == 0) {
+        return 0;
+    }
+    size_t index = (size_t)(p / 100.0 * (n - 1) + 0.5);
+    return sorted[index];
+}
+
+/*
+ * print_latency - Sorts the latencies of one operation type and prints the
+ * median, 99th percentile and maximum in nanoseconds.
+ */
+static void print_latency(char *name, uint64_t *latency, size_t n) {
+    qsort(latency, n, sizeof(uint64_t), compare_latency);
+    printf(" %s p50 %6lu p99 %6lu max %8lu", name, percentile(latency, n, 50),
+        percentile(latency, n, 99), n ? latency[n - 1] : 0);
+}
+
+/*
+ * run_trace - Replays the trace the same way performance.c does, timing each
+ * umalloc, urealloc and ufree call on its own. The sbrk calls made between
+ * operations are not timed. urealloc is only reported for traces that use it.
+ */
+static void run_trace(char *file, trace_t *trace) {
+    uint64_t *alloc_latency = calloc(trace->num_ops, sizeof(uint64_t));
+    uint64_t *free_latency = calloc(trace->num_ops, sizeof(uint64_t));
+    uint64_t *realloc_latency = calloc(trace->num_ops, sizeof(uint64_t));
+    size_t num_allocs = 0;
+    size_t num_frees = 0;
+    size_t num_reallocs = 0;
+    if (alloc_latency == NULL || free_latency == NULL || realloc_latency == NULL) {
+        appl_error("Failed to allocate latency arrays");
+    }
+
+    uinit();
+    for (size_t curr_op = 0; curr_op < trace->num_ops; curr_op++) {
+        if (curr_op % 5 == 0) {
+            sbrk(4096);
+        }
+        traceop_t op = trace->ops[curr_op];
+        uint64_t start = now_ns();
+        if (op.type == ALLOC) {
+            trace->blocks[op.index].payload = umalloc(op.size);
+            alloc_latency[num_allocs++] = now_ns() - start;
+        } else if (op.type == REALLOC) {
+            trace->blocks[op.index].payload = urealloc(trace->blocks[op.index].payload, op.size);
+            realloc_latency[num_reallocs++] = now_ns() - start;
+        } else {
+            ufree(trace->blocks[op.index].payload);
+            free_latency[num_frees++] = now_ns() - start;
+        }
+    }
+
+    printf("%-28s", file);
+    print_latency("umalloc", alloc_latency, num_allocs);
+    print_latency("ufree", free_latency, num_frees);
+    if (num_reallocs > 0) {
+        print_latency("urealloc", realloc_latency, num_reallocs);
+    }
+    printf("\n");
+    free(alloc_latency);
+    free(free_latency);
+    free(realloc_latency);
+}
+
+int main(int argc, char **argv) {
+    int c;
+    int fit_policy = FIT_SEGREGATED;
+    while ((c = getopt(argc, argv, "p:")) != EOF) {
+        switch (c) {
+        case 'p':
+            fit_policy = parse_fit_policy(optarg);
+            if (fit_policy == -1) {
+                fprintf(stderr, "Unknown policy %s, expected seg, best or tlsf\n", optarg);
+                exit(1);
+            }
+            break;
+        default:
+            fprintf(stderr, "Usage: latency [-p policy] file\n");
+            exit(1);
+        }
+    }
+    if (optind >= argc) {
+        fprintf(stderr, "Usage: latency [-p policy] file\n");
+        appl_error("No File parameter provided.");
+    }
+    umallopt(M_FIT_POLICY, fit_policy);
+    trace_t *trace = read_trace(argv[optind], 0);
+    run_trace(argv[optind], trace);
+    free_trace(trace);
+    return 0;
+}
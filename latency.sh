@@ -0,0 +1,6 @@
+#!/bin/sh
+# Reports per operation umalloc/ufree latency (ns) for every trace.
+# Any arguments, e.g. -p tlsf, are passed on to ./latency.
+for trace in traces/*.rep; do
+  ./latency "$@" "$trace"
+done
@@ -0,0 +1,149 @@
+/**************************************************************************
+ * C S 429 MM-lab
+ * 
+ * mtbench.c - Replays a trace on 1 to N threads at once and reports how the
+ * umalloc package's throughput scales with the number of threads.
+ **************************************************************************/
+
+#include "umalloc.h"
+#include "support.h"
+#include <pthread.h>
+
+static trace_t *trace;
+static int repetitions = 10;
+
+// In cross mode a thread's frees are collected in its outbox and carried out
+// by the next thread, so most of them land on another thread's arena.
+static int cross;
+static int running_threads;
+static void ***outboxes;
+static size_t *outbox_lens;
+static pthread_barrier_t barrier;
+
+/*
+ * replay - Thread body. Replays the shared trace repetitions times, keeping
+ * its own payload pointers so threads never touch each other's blocks, unless
+ * cross mode hands the frees to the neighbouring thread after every repetition.
+ */
+static void *replay(void *arg) {
+    int self = (int)(intptr_t)arg;
+    void **payloads = calloc(trace->num_ids, sizeof(void *));
+    if (payloads == NULL) {
+        appl_error("Failed to allocate payload array");
+    }
+    for (int rep = 0; rep < repetitions; rep++) {
+        for (size_t curr_op = 0; curr_op < trace->num_ops; curr_op++) {
+            traceop_t op = trace->ops[curr_op];
+            if (op.type == ALLOC) {
+                payloads[op.index] = umalloc(op.size);
+            } else if (op.type == REALLOC) {
+                payloads[op.index] = urealloc(payloads[op.index], op.size);
+            } else if (cross) {
+                outboxes[self][outbox_lens[self]++] = payloads[op.index];
+            } else {
+                ufree(payloads[op.index]);
+            }
+        }
+        if (cross) {
+            int other = (self + 1) % running_threads;
+            pthread_barrier_wait(&barrier);
+            for (size_t i = 0; i < outbox_lens[other]; i++) {
+                ufree(outboxes[other][i]);
+            }
+            pthread_barrier_wait(&barrier);
+            outbox_lens[self] = 0;
+        }
+    }
+    free(payloads);
+    return NULL;
+}
+
+/*
+ * run_threads - Starts num_threads replaying threads, waits for all of them and
+ * returns the elapsed time in microseconds.
+ */
+static uint64_t run_threads(int num_threads) {
+    pthread_t threads[num_threads];
+    struct timespec start, end;
+    running_threads = num_threads;
+    pthread_barrier_init(&barrier, NULL, num_threads);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < num_threads; i++) {
+        if (pthread_create(&threads[i], NULL, replay, (void *)(intptr_t)i) != 0) {
+            appl_error("pthread_create failed");
+        }
+    }
+    for (int i = 0; i < num_threads; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    pthread_barrier_destroy(&barrier);
+    return (end.tv_sec - start.tv_sec) * 1000000 + (end.tv_nsec - start.tv_nsec) / 1000;
+}
+
+int main(int argc, char **argv) {
+    int c;
+    int fit_policy = FIT_SEGREGATED;
+    int max_threads = sysconf(_SC_NPROCESSORS_ONLN);
+    int num_arenas = 0;
+    while ((c = getopt(argc, argv, "p:t:n:a:x")) != EOF) {
+        switch (c) {
+        case 'p':
+            fit_policy = parse_fit_policy(optarg);
+            if (fit_policy == -1) {
+                fprintf(stderr, "Unknown policy %s, expected seg, best or tlsf\n", optarg);
+                exit(1);
+            }
+            break;
+        case 't':
+            max_threads = atoi(optarg);
+            break;
+        case 'n':
+            repetitions = atoi(optarg);
+            break;
+        case 'a':
+            num_arenas = atoi(optarg);
+            break;
+        case 'x':
+            cross = 1;
+            break;
+        default:
+            fprintf(stderr, "Usage: mtbench [-p policy] [-t max threads] [-n repetitions] [-a arenas] [-x] file\n");
+            exit(1);
+        }
+    }
+    if (optind >= argc || max_threads < 1 || repetitions < 1) {
+        fprintf(stderr, "Usage: mtbench [-p policy] [-t max threads] [-n repetitions] [-a arenas] [-x] file\n");
+        appl_error("No File parameter provided.");
+    }
+    umallopt(M_FIT_POLICY, fit_policy);
+    if (num_arenas > 0 && umallopt(M_ARENAS, num_arenas) == -1) {
+        appl_error("Invalid number of arenas");
+    }
+    trace = read_trace(argv[optind], 0);
+    uinit();
+    outboxes = calloc(max_threads, sizeof(void **));
+    outbox_lens = calloc(max_threads, sizeof(size_t));
+    for (int i = 0; i < max_threads; i++) {
+        outboxes[i] = malloc(trace->num_ops * sizeof(void *));
+    }
+
+    double base = 0;
+    printf("threads  ops/ms      speedup\n");
+    for (int num_threads = 1; num_threads <= max_threads; num_threads++) {
+        uint64_t delta_us = run_threads(num_threads);
+        double ops = (double)trace->num_ops * repetitions * num_threads;
+        double throughput = ops / (delta_us ? delta_us : 1) * 1000;
+        if (num_threads == 1) {
+            base = throughput;
+        }
+        printf("%7d  %-10.0f  %.2fx\n", num_threads, throughput, throughput / base);
+    }
+    for (int i = 0; i < max_threads; i++) {
+        free(outboxes[i]);
+    }
+    free(outboxes);
+    free(outbox_lens);
+    free_trace(trace);
+    return 0;
+}
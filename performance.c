@@ -10,6 +10,8 @@
 #include "umalloc.h"
 #include "support.h"
 
+static int sized_free;
+
 static void run_trace(trace_t *trace) {
 
     struct timespec start, end;
@@ -22,6 +24,12 @@ static void run_trace(trace_t *trace) {
         traceop_t op = trace->ops[curr_op];
         if (op.type == ALLOC) {
             trace->blocks[op.index].payload = umalloc(op.size);
+            trace->blocks[op.index].block_size = op.size;
+        } else if (op.type == REALLOC) {
+            trace->blocks[op.index].payload = urealloc(trace->blocks[op.index].payload, op.size);
+            trace->blocks[op.index].block_size = op.size;
+        } else if (sized_free) {
+            ufree_sized(trace->blocks[op.index].payload, trace->blocks[op.index].block_size);
         } else {
             ufree(trace->blocks[op.index].payload);
         }
@@ -34,11 +42,43 @@ static void run_trace(trace_t *trace) {
 
 
 int main(int argc, char **argv) { 
-    if (argc < 2) {
-        fprintf(stderr, "Usage: performance file\n");
+    int c;
+    int fit_policy = FIT_SEGREGATED;
+    int split_policy = SPLIT_HIGH;
+    while ((c = getopt(argc, argv, "p:sde:")) != EOF) {
+        switch (c) {
+        case 'p':
+            fit_policy = parse_fit_policy(optarg);
+            if (fit_policy == -1) {
+                fprintf(stderr, "Unknown policy %s, expected seg, best or tlsf\n", optarg);
+                exit(1);
+            }
+            break;
+        case 's':
+            sized_free = 1;
+            break;
+        case 'd':
+            umallopt(M_DEFERRED, 1);
+            break;
+        case 'e':
+            split_policy = parse_split_policy(optarg);
+            if (split_policy == -1) {
+                fprintf(stderr, "Unknown split policy %s, expected high, low or size\n", optarg);
+                exit(1);
+            }
+            break;
+        default:
+            fprintf(stderr, "Usage: performance [-p policy] [-s] [-d] [-e split] file\n");
+            exit(1);
+        }
+    }
+    if (optind >= argc) {
+        fprintf(stderr, "Usage: performance [-p policy] [-s] [-d] [-e split] file\n");
         appl_error("No File parameter provided.");
     }
-    trace_t *trace = read_trace(argv[1], 0);
+    umallopt(M_FIT_POLICY, fit_policy);
+    umallopt(M_SPLIT_POLICY, split_policy);
+    trace_t *trace = read_trace(argv[optind], 0);
     run_trace(trace);
     free_trace(trace);
     return 0;
@@ -0,0 +1,173 @@
+/**************************************************************************
+ * C S 429 MM-lab
+ *
+ * pmrbench.cpp - Times std::vector, std::map and std::unordered_map workloads
+ * with the default allocator against the umalloc adapters in umalloc.hpp:
+ * um::allocator, um::resource and um::monotonic_resource.
+ **************************************************************************/
+
+#include "umalloc.hpp"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <memory_resource>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+
+static int rounds = 20;
+static long count = 10000;
+
+// Vectors built per round by the vector workload, each count / VECTORS long.
+#define VECTORS 100
+
+struct result {
+    double us;
+    long checksum;
+};
+
+/*
+ * key - spreads the i-th key over the key space, so inserts hit every part
+ * of a tree rather than always its right edge.
+ */
+static long key(long i) {
+    return (i * 2654435761L) % (count * 4);
+}
+
+/*
+ * timed - runs a workload rounds times, calling reset after each round, and
+ * returns how long it took along with the checksum it computed.
+ */
+template <typename Work, typename Reset>
+static result timed(Work work, Reset reset) {
+    long checksum = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (int round = 0; round < rounds; round++) {
+        checksum += work();
+        reset();
+    }
+    std::chrono::duration<double, std::micro> elapsed = std::chrono::steady_clock::now() - start;
+    return {elapsed.count(), checksum};
+}
+
+/*
+ * vector_work - grows VECTORS vectors one push_back at a time, so each goes
+ * through every reallocation on the way to its final size.
+ */
+template <typename Make>
+static long vector_work(Make make) {
+    long sum = 0;
+    for (int v = 0; v < VECTORS; v++) {
+        auto vec = make();
+        for (long i = 0; i < count / VECTORS; i++) {
+            vec.push_back(i + v);
+        }
+        sum += vec.size() + vec.back();
+    }
+    return sum;
+}
+
+/*
+ * map_work - inserts count keys, erases every other one and inserts them
+ * again, leaving freed nodes scattered among live ones.
+ */
+template <typename Make>
+static long map_work(Make make) {
+    auto map = make();
+    for (long i = 0; i < count; i++) {
+        map.emplace(key(i), i);
+    }
+    for (long i = 0; i < count; i += 2) {
+        map.erase(key(i));
+    }
+    for (long i = 0; i < count; i += 2) {
+        map.emplace(key(i), i);
+    }
+    long sum = 0;
+    for (auto &entry : map) {
+        sum += entry.second;
+    }
+    return sum + map.size();
+}
+
+/*
+ * run - times one workload with each allocator and prints a row of the table.
+ * The checksums must agree, or one of the adapters lost data.
+ */
+template <typename Default, typename Alloc, typename Resource, typename Monotonic>
+static void run(const char *name, Default with_default, Alloc with_allocator, Resource with_resource,
+                Monotonic with_monotonic, um::monotonic_resource &monotonic) {
+    auto none = [] {};
+    result results[4] = {
+        timed(with_default, none),
+        timed(with_allocator, none),
+        timed(with_resource, none),
+        timed(with_monotonic, [&monotonic] { monotonic.release(); }),
+    };
+    printf("%-16s", name);
+    for (result &res : results) {
+        printf("%14.0f", res.us);
+        if (res.checksum != results[0].checksum) {
+            fprintf(stderr, "%s: checksum mismatch\n", name);
+            exit(1);
+        }
+    }
+    printf("\n");
+}
+
+static void usage(void) {
+    fprintf(stderr, "Usage: pmrbench [-n count] [-r rounds]\n");
+    fprintf(stderr, "\t-n count   Elements per container (default 10000).\n");
+    fprintf(stderr, "\t-r rounds  Times each workload is repeated (default 20).\n");
+}
+
+int main(int argc, char **argv) {
+    int c;
+    while ((c = getopt(argc, argv, "n:r:")) != EOF) {
+        switch (c) {
+        case 'n':
+            count = atol(optarg);
+            break;
+        case 'r':
+            rounds = atoi(optarg);
+            break;
+        default:
+            usage();
+            exit(1);
+        }
+    }
+    if (count < VECTORS || rounds < 1) {
+        usage();
+        exit(1);
+    }
+    if (uinit() == -1) {
+        fprintf(stderr, "uinit failed.\n");
+        exit(1);
+    }
+    um::monotonic_resource monotonic;
+    std::pmr::memory_resource *resource = um::get_resource();
+
+    using um_pair = um::allocator<std::pair<const long, long>>;
+    printf("Times in us, %ld elements, %d rounds\n", count, rounds);
+    printf("%-16s%14s%14s%14s%14s\n", "workload", "std", "um::allocator", "um::resource", "monotonic");
+    run("vector",
+        [] { return vector_work([] { return std::vector<long>(); }); },
+        [] { return vector_work([] { return std::vector<long, um::allocator<long>>(); }); },
+        [&] { return vector_work([&] { return std::pmr::vector<long>(resource); }); },
+        [&] { return vector_work([&] { return std::pmr::vector<long>(&monotonic); }); },
+        monotonic);
+    run("map",
+        [] { return map_work([] { return std::map<long, long>(); }); },
+        [] { return map_work([] { return std::map<long, long, std::less<long>, um_pair>(); }); },
+        [&] { return map_work([&] { return std::pmr::map<long, long>(resource); }); },
+        [&] { return map_work([&] { return std::pmr::map<long, long>(&monotonic); }); },
+        monotonic);
+    run("unordered_map",
+        [] { return map_work([] { return std::unordered_map<long, long>(); }); },
+        [] { return map_work([] { return std::unordered_map<long, long, std::hash<long>, std::equal_to<long>, um_pair>(); }); },
+        [&] { return map_work([&] { return std::pmr::unordered_map<long, long>(resource); }); },
+        [&] { return map_work([&] { return std::pmr::unordered_map<long, long>(&monotonic); }); },
+        monotonic);
+    return 0;
+}
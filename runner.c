@@ -12,9 +12,11 @@
 #include "support.h"
 #include "check_heap.h"
 #include <sys/mman.h>
+#include <sys/wait.h>
 
 int verbose = 0;
-char msg[MAXLINE];      /* for whenever we need to compose an error message */
+static char msg[MAXLINE];      /* for whenever we need to compose an error message */
+static char *split_names[] = {"high", "low", "size"}; /* indexed by split policy */
 extern size_t sbrk_bytes;
 extern const char author[];
 
@@ -23,13 +25,20 @@ extern const char author[];
  */
 static void usage(void) 
 {
-    fprintf(stderr, "Usage: mdriver [-rhvuc] file\n");
+    fprintf(stderr, "Usage: mdriver [-rhvucd] [-p policy] [-g bytes] [-e split] [-m bytes] file\n");
     fprintf(stderr, "Options\n");
     fprintf(stderr, "\t-r         Run the trace to completion (bypass interface).\n");
     fprintf(stderr, "\t-h         Print this message.\n");
     fprintf(stderr, "\t-v         Print additional debug info.\n");
     fprintf(stderr, "\t-u         Display heap utilization.\n");
     fprintf(stderr, "\t-c         Runs the user provided heap check after every op.\n");
+    fprintf(stderr, "\t-p policy  Placement policy: seg (default), best or tlsf.\n");
+    fprintf(stderr, "\t-g bytes   Growth quantum the heap is extended by (default one page).\n");
+    fprintf(stderr, "\t-d         Defer coalescing small blocks onto quick lists.\n");
+    fprintf(stderr, "\t-e split   End of a free block allocations are split from: high (default),\n");
+    fprintf(stderr, "\t           low, size (small blocks high, large ones low) or all, which\n");
+    fprintf(stderr, "\t           runs the trace once with each. all needs -r.\n");
+    fprintf(stderr, "\t-m bytes   Smallest free remainder a split may leave (default 32).\n");
 }
 
 /* 
@@ -96,8 +105,8 @@ size_t max_bytes_in_use;
 /* 
  * run_trace_line - Runs a single line in the trace. Checking if all the 
  * correctness checks are still satisfied after the check. Checks if the returned
- * payload is aligned to 16 bytes, hasn't affected any other blocks, and rests
- * within the sbrk range. Runs the user created check heap function and prints
+ * payload is aligned to 16 bytes, hasn't affected any other blocks, and that
+ * all of its usable size rests within the sbrk range. Runs the user created check heap function and prints
  * the current utilization score if requested. 
  */
 static int run_trace_line(trace_t *trace, size_t curr_op, int utilization, int run_check_heap) {
@@ -128,12 +137,61 @@ static int run_trace_line(trace_t *trace, size_t curr_op, int utilization, int r
             return -1;
         }
 
-        if(check_malloc_output(trace->blocks[op.index].payload, trace->blocks[op.index].block_size) == -1) {
+        // the whole usable size must be ours to write, not just the bytes asked for
+        size_t usable = uusable_size(trace->blocks[op.index].payload);
+        if (usable < (size_t)op.size) {
+            malloc_error(curr_op, "uusable_size is smaller than the requested size.");
+            return -1;
+        }
+
+        if(check_malloc_output(trace->blocks[op.index].payload, usable) == -1) {
             printf("line %ld: umalloc allocated a block out of bounds.\n", LINENUM(curr_op));
             return -1;
         }
 
-        copy_id((size_t*) trace->blocks[op.index].payload, trace->blocks[op.index].block_size, curr_op);
+        copy_id((size_t*) trace->blocks[op.index].payload, usable, curr_op);
+    } else if (op.type == REALLOC) {
+        allocated_block_t *block = &trace->blocks[op.index];
+        size_t old_size = block->is_allocated ? block->block_size : 0;
+        size_t kept = old_size < (size_t)op.size ? old_size : (size_t)op.size;
+
+        if (verbose) {
+            printf("line %ld: urealloc: id %d, Resizing to %d bytes\n", LINENUM(curr_op), op.index, op.size);
+        }
+
+        block->payload = urealloc(block->is_allocated ? block->payload : NULL, op.size);
+        curr_bytes_in_use += op.size - old_size;
+        if (block->payload == NULL) {
+            malloc_error(curr_op, "urealloc failed.");
+            return -1;
+        }
+
+        if (((size_t)block->payload) % ALIGNMENT != 0) {
+            malloc_error(curr_op, "urealloc returned an unaligned payload.");
+            return -1;
+        }
+
+        size_t usable = uusable_size(block->payload);
+        if (usable < (size_t)op.size) {
+            malloc_error(curr_op, "uusable_size is smaller than the requested size.");
+            return -1;
+        }
+
+        if(check_malloc_output(block->payload, usable) == -1) {
+            printf("line %ld: urealloc allocated a block out of bounds.\n", LINENUM(curr_op));
+            return -1;
+        }
+
+        // the bytes that fit in both the old and new size must have been kept
+        if (check_id((size_t*) block->payload, kept, block->content_val) == -1) {
+            malloc_error(curr_op, "urealloc did not preserve the block contents.");
+            return -1;
+        }
+
+        block->is_allocated = true;
+        block->content_val = curr_op;
+        block->block_size = op.size;
+        copy_id((size_t*) block->payload, usable, curr_op);
     } else {
         trace->blocks[op.index].is_allocated = false;
 
@@ -300,11 +358,16 @@ int main(int argc, char **argv)
 
   char c;
   int autorun = 0, run_check_heap = 0, display_utilization = 0;
+  int fit_policy = FIT_SEGREGATED;
+  int grow_quantum = 0;
+  int deferred = 0;
+  int split_policy = SPLIT_HIGH, split_all = 0;
+  int split_min = 0;
 
   /* 
     * Read and interpret the command line arguments 
     */
-  while ((c = getopt(argc, argv, "rvhcu")) != EOF) {
+  while ((c = getopt(argc, argv, "rvhcudp:g:e:m:")) != EOF) {
     switch (c) {
     case 'r': /* Generate summary info for the autograder */
         autorun = 1;
@@ -321,6 +384,30 @@ int main(int argc, char **argv)
     case 'u':
         display_utilization = 1;
         break;
+    case 'p':
+        fit_policy = parse_fit_policy(optarg);
+        if (fit_policy == -1) {
+            usage();
+            exit(1);
+        }
+        break;
+    case 'g':
+        grow_quantum = atoi(optarg);
+        break;
+    case 'd':
+        deferred = 1;
+        break;
+    case 'e':
+        split_all = strcmp(optarg, "all") == 0;
+        split_policy = split_all ? SPLIT_HIGH : parse_split_policy(optarg);
+        if (split_policy == -1) {
+            usage();
+            exit(1);
+        }
+        break;
+    case 'm':
+        split_min = atoi(optarg);
+        break;
     default:
         usage();
         exit(1);
@@ -352,6 +439,48 @@ int main(int argc, char **argv)
     printf("Author: %s\n", author);
 
     trace_t *trace = read_trace(file, verbose);
+    if (split_all) {
+        //every policy needs a fresh heap, so each gets a child process of its own
+        if (!autorun) {
+            appl_error("-e all needs -r.");
+        }
+        for (; split_policy <= SPLIT_BY_SIZE; split_policy++) {
+            fflush(stdout);
+            pid_t pid = fork();
+            if (pid == 0) {
+                break;
+            }
+            int status;
+            if (pid == -1 || waitpid(pid, &status, 0) == -1 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+                exit(1);
+            }
+        }
+        if (split_policy > SPLIT_BY_SIZE) {
+            free_trace(trace);
+            return 0;
+        }
+        printf("\nSplit policy: %s\n", split_names[split_policy]);
+    }
+    if (umallopt(M_FIT_POLICY, fit_policy) == -1) {
+        malloc_error(-3, "umallopt failed.");
+        exit(1);
+    }
+    if (grow_quantum != 0 && umallopt(M_GROW_QUANTUM, grow_quantum) == -1) {
+        malloc_error(-3, "umallopt failed.");
+        exit(1);
+    }
+    if (deferred && umallopt(M_DEFERRED, 1) == -1) {
+        malloc_error(-3, "umallopt failed.");
+        exit(1);
+    }
+    if (umallopt(M_SPLIT_POLICY, split_policy) == -1) {
+        malloc_error(-3, "umallopt failed.");
+        exit(1);
+    }
+    if (split_min != 0 && umallopt(M_SPLIT_MIN, split_min) == -1) {
+        malloc_error(-3, "umallopt failed.");
+        exit(1);
+    }
     if (uinit() == -1) {
         malloc_error(-3, "uinit failed.");
         exit(1);
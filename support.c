@@ -9,6 +9,7 @@
 
 #include "support.h"
 #include "err_handler.h"
+#include "umalloc.h"
 
 char msg[MAXLINE];      /* for whenever we need to compose an error message */
 
@@ -94,6 +95,16 @@ trace_t *read_trace(char *filename, int verbose)
             trace->ops[op_index].size = size;
             max_index = (index > max_index) ? index : max_index;
             break;
+        case 'r':
+            err = fscanf(tracefile, "%u %u", &index, &size);
+            if (err == EOF) {
+                appl_error("fscanf failed to find index and size.");
+            }
+            trace->ops[op_index].type = REALLOC;
+            trace->ops[op_index].index = index;
+            trace->ops[op_index].size = size;
+            max_index = (index > max_index) ? index : max_index;
+            break;
         case 'f':
             err = fscanf(tracefile, "%ud", &index);
             if (err == EOF) {
@@ -125,4 +136,34 @@ void free_trace(trace_t *trace)
     free(trace->ops);         /* free the two arrays... */
     free(trace->blocks);      
     free(trace);              /* and the trace record itself... */
-}
\ No newline at end of file
+}
+
+/*
+ * parse_fit_policy - map a placement policy name given on the command line
+ *                    to its umallopt() value, or -1 if it is not known.
+ */
+int parse_fit_policy(char *name)
+{
+    if (strcmp(name, "seg") == 0)
+        return FIT_SEGREGATED;
+    if (strcmp(name, "best") == 0)
+        return FIT_BEST;
+    if (strcmp(name, "tlsf") == 0)
+        return FIT_TLSF;
+    return -1;
+}
+
+/*
+ * parse_split_policy - map a split policy name given on the command line
+ *                      to its umallopt() value, or -1 if it is not known.
+ */
+int parse_split_policy(char *name)
+{
+    if (strcmp(name, "high") == 0)
+        return SPLIT_HIGH;
+    if (strcmp(name, "low") == 0)
+        return SPLIT_LOW;
+    if (strcmp(name, "size") == 0)
+        return SPLIT_BY_SIZE;
+    return -1;
+}
@@ -0,0 +1,36 @@
+#!/usr/bin/perl
+#!/usr/local/bin/perl
+
+$out_filename = "large.rep";
+$small_size = 200;
+$min_large = 64 * 1024;
+$max_large = 4 * 1024 * 1024;
+$num_iters = 64;
+
+srand(429);
+
+# Open output file
+open OUTFILE, ">$out_filename" or die "Cannot create $out_filename\n";
+
+# Calculate misc parameters
+$num_blocks = 2*$num_iters + 1;
+$num_ops = 4*$num_iters + 1;
+
+print OUTFILE "$num_blocks\n";
+print OUTFILE "$num_ops\n";
+
+# Buffers of up to a few megabytes, far past the csbrk() limit, come and go
+# between small blocks. One buffer keeps growing through realloc.
+print OUTFILE "a 0 $min_large\n";
+for ($i = 0;  $i < $num_iters; $i += 1) {
+    $large = $min_large + int(rand($max_large - $min_large));
+    $grown = $min_large + ($i + 1) * int($max_large / $num_iters);
+    $lseq = 2*$i + 1;
+    $sseq = 2*$i + 2;
+    print OUTFILE "a $lseq $large\n";
+    print OUTFILE "a $sseq $small_size\n";
+    print OUTFILE "r 0 $grown\n";
+    print OUTFILE "f $lseq\n";
+}
+
+close OUTFILE;
@@ -0,0 +1,33 @@
+#!/usr/bin/perl
+#!/usr/local/bin/perl
+
+$out_filename = "realloc.rep";
+$start_size = 512;
+$grow_size = 10;
+$small_size = 128;
+$num_iters = 4800;
+
+# Open output file
+open OUTFILE, ">$out_filename" or die "Cannot create $out_filename\n";
+
+# Calculate misc parameters
+$num_blocks = $num_iters + 2;
+$num_ops = 3*$num_iters + 2;
+
+print OUTFILE "$num_blocks\n";
+print OUTFILE "$num_ops\n";
+
+# One buffer grows steadily while small blocks are allocated right after it
+# and freed again, so each realloc finds its neighbour free.
+print OUTFILE "a 0 $start_size\n";
+print OUTFILE "a 1 $small_size\n";
+for ($i = 1;  $i <= $num_iters; $i += 1) {
+    $size = $start_size + $i*$grow_size;
+    $aseq = $i + 1;
+    $fseq = $i;
+    print OUTFILE "r 0 $size\n";
+    print OUTFILE "a $aseq $small_size\n";
+    print OUTFILE "f $fseq\n";
+}
+
+close OUTFILE;
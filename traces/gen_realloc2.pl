@@ -0,0 +1,40 @@
+#!/usr/bin/perl
+#!/usr/local/bin/perl
+
+$out_filename = "realloc2.rep";
+$start_size = 4092;
+$grow_size = 5;
+$shrink_every = 64;
+$shrink_size = 256;
+$small_size = 16;
+$num_iters = 4800;
+
+# Open output file
+open OUTFILE, ">$out_filename" or die "Cannot create $out_filename\n";
+
+# Calculate misc parameters
+$num_blocks = $num_iters + 2;
+$num_ops = 3*$num_iters + 2;
+
+print OUTFILE "$num_blocks\n";
+print OUTFILE "$num_ops\n";
+
+# Like realloc.rep but the buffer grows by a few unaligned bytes at a time and
+# every so often shrinks back, so both directions are exercised.
+$size = $start_size;
+print OUTFILE "a 0 $size\n";
+print OUTFILE "a 1 $small_size\n";
+for ($i = 1;  $i <= $num_iters; $i += 1) {
+    if ($i % $shrink_every == 0) {
+        $size -= $shrink_size;
+    } else {
+        $size += $grow_size;
+    }
+    $aseq = $i + 1;
+    $fseq = $i;
+    print OUTFILE "r 0 $size\n";
+    print OUTFILE "a $aseq $small_size\n";
+    print OUTFILE "f $fseq\n";
+}
+
+close OUTFILE;
@@ -2,7 +2,14 @@
 #include "csbrk.h"
 #include "ansicolors.h"
 #include <stdio.h>
+#include <string.h>
 #include <assert.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <time.h>
+
+#define CSBRK_MAX (16 * PAGESIZE) /* Largest increment csbrk() accepts */
 
 const char author[] = ANSI_BOLD ANSI_COLOR_RED "Rayan Ali ra37589" ANSI_RESET;
 
@@ -11,8 +18,52 @@ const char author[] = ANSI_BOLD ANSI_COLOR_RED "Rayan Ali ra37589" ANSI_RESET;
  * struct, they can be adjusted as necessary.
  */
 
-// A sample pointer to the start of the free list.
-memory_block_t *free_head;
+// Placement policy selected through umallopt(), FIT_SEGREGATED by default.
+static int fit_policy = FIT_SEGREGATED;
+
+// How the heap grows, see M_GROW_QUANTUM and M_GROW_GEOMETRIC.
+static size_t grow_quantum = PAGESIZE;
+static bool grow_geometric;
+
+// When free memory goes back to the kernel, see M_TRIM_THRESHOLD and M_DECAY_MS.
+static size_t trim_threshold = 128 * 1024;
+static int decay_ms = 10000;
+
+// Whether small frees wait on the arena's quick lists, see M_DEFERRED.
+static bool deferred;
+
+// Where split() carves allocations from and what it leaves, see M_SPLIT_POLICY and M_SPLIT_MIN.
+static int split_policy = SPLIT_HIGH;
+static size_t split_min = MIN_BLOCK_SIZE;
+
+// The arenas. The first num_arenas are handed out to threads in turn, and each
+// owns its own sbrk'd regions and free structures under its own lock.
+arena_t arenas[MAX_ARENAS];
+int num_arenas;
+static unsigned next_arena;
+
+// The arena this thread allocates from. The helpers below all work on it.
+__thread arena_t *thread_arena;
+
+// Serializes csbrk(), which every arena grows through.
+static pthread_mutex_t sbrk_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// The page map, a three level radix tree from page number to the span_t of
+// every heap page, so ufree() finds a pointer's slab run or owning arena in
+// constant time. Nodes are mmap'd and never freed, so readers take no lock and
+// only writers hold pagemap_lock. Region spans are carved from span_pool.
+typedef span_t *pagemap_leaf_t[PAGEMAP_FANOUT];
+typedef pagemap_leaf_t *pagemap_node_t[PAGEMAP_FANOUT];
+static pagemap_node_t *page_map[PAGEMAP_FANOUT];
+static pthread_mutex_t pagemap_lock = PTHREAD_MUTEX_INITIALIZER;
+static char *span_pool;
+static size_t span_pool_left;
+
+// This thread's cache of small blocks, used without taking any lock. The key
+// only exists so the cache is flushed back to the heap when the thread exits.
+__thread tcache_t tcache;
+static pthread_key_t tcache_key;
+static pthread_once_t tcache_once = PTHREAD_ONCE_INIT;
 
 /*
  * is_allocated - returns true if a block is marked as allocated.
@@ -44,7 +95,7 @@ void deallocate(memory_block_t *block) {
  */
 size_t get_size(memory_block_t *block) {
     assert(block != NULL);
-    return block->block_size_alloc & ~(ALIGNMENT-1);
+    return block->block_size_alloc & SIZE_MASK;
 }
 
 /*
@@ -55,19 +106,123 @@ memory_block_t *get_next(memory_block_t *block) {
     return block->next;
 }
 
+/*
+ * get_prev - gets the previous block on a free list. The back link lives in
+ * the second word of the payload, right after next, so only free blocks have one.
+ */
+memory_block_t *get_prev(memory_block_t *block) {
+    assert(block != NULL);
+    return ((memory_block_t **)get_payload(block))[1];
+}
+
+/*
+ * set_prev - sets the previous block on a free list.
+ */
+void set_prev(memory_block_t *block, memory_block_t *prev) {
+    assert(block != NULL);
+    ((memory_block_t **)get_payload(block))[1] = prev;
+}
+
+/*
+ * is_prev_alloc - returns true if the block physically before this one is
+ * allocated (or this is the first block of a region).
+ */
+bool is_prev_alloc(memory_block_t *block) {
+    assert(block != NULL);
+    return block->block_size_alloc & PREV_ALLOC;
+}
+
+/*
+ * set_prev_alloc - records the allocated status of the block physically before
+ * this one.
+ */
+void set_prev_alloc(memory_block_t *block, bool prev_alloc) {
+    assert(block != NULL);
+    //atomic because the owner of an allocated block may be reading its size
+    //without the heap lock while a neighbor changes state
+    if (prev_alloc) {
+        __atomic_fetch_or(&block->block_size_alloc, PREV_ALLOC, __ATOMIC_RELAXED);
+    }
+    else {
+        __atomic_fetch_and(&block->block_size_alloc, ~(size_t)PREV_ALLOC, __ATOMIC_RELAXED);
+    }
+}
+
+/*
+ * is_small - returns true if the block is one of the exact size classes.
+ */
+bool is_small(memory_block_t *block) {
+    assert(block != NULL);
+    return block->block_size_alloc & SMALL_CLASS;
+}
+
+/*
+ * is_zeroed - returns true if the block's payload is known to be zero apart
+ * from the free block links in its first two words and the footer in its last.
+ */
+bool is_zeroed(memory_block_t *block) {
+    assert(block != NULL);
+    return block->block_size_alloc & ZEROED;
+}
+
+/*
+ * set_zeroed - marks a block whose payload has never been written since it
+ * came from csbrk. put_block() clears the mark, so any block that is rebuilt
+ * or merged loses it.
+ */
+void set_zeroed(memory_block_t *block) {
+    assert(block != NULL);
+    block->block_size_alloc |= ZEROED;
+}
+
 /*
  * put_block - puts a block struct into memory at the specified address.
- * Initializes the size and allocated fields, along with NUlling out the next 
- * field.
+ * Initializes the size, allocated and prev allocated fields, along with
+ * NUlling out the next field. Free blocks also get a footer holding their size.
  */
-void put_block(memory_block_t *block, size_t size, bool alloc) {
+void put_block(memory_block_t *block, size_t size, bool alloc, bool prev_alloc) {
     assert(block != NULL);
     assert(size % ALIGNMENT == 0);
     assert(alloc >> 1 == 0);
     block->block_size_alloc = size | alloc;
-    block->block_size_alloc |= 0x4;
-    block->block_size_alloc |= 0x2;
-    block->next = NULL;
+    if (size < TREE_MIN_SIZE) {
+        block->block_size_alloc |= SMALL_CLASS;
+    }
+    set_prev_alloc(block, prev_alloc);
+    //next is the first payload word, which an epilogue does not have
+    if (!alloc) {
+        block->next = NULL;
+        *((size_t *)((char *)block + size) - 1) = size;
+    }
+}
+
+/*
+ * set_size - changes the size of a block in place, keeping its other bits
+ * apart from SMALL_CLASS, which follows the new size.
+ */
+static void set_size(memory_block_t *block, size_t size) {
+    size_t flags = block->block_size_alloc & ~(SIZE_MASK | SMALL_CLASS);
+    block->block_size_alloc = flags | size | (size < TREE_MIN_SIZE ? SMALL_CLASS : 0);
+}
+
+/*
+ * next_block - gets the block physically after this one. Every region ends in
+ * an allocated epilogue header, so this never leaves the region.
+ */
+memory_block_t *next_block(memory_block_t *block) {
+    assert(block != NULL);
+    return (memory_block_t *)((char *)block + get_size(block));
+}
+
+/*
+ * prev_block - gets the block physically before this one by reading its footer.
+ * Only valid when that block is free.
+ */
+memory_block_t *prev_block(memory_block_t *block) {
+    assert(block != NULL);
+    assert(!is_prev_alloc(block));
+    size_t size = *((size_t *)block - 1);
+    return (memory_block_t *)((char *)block - size);
 }
 
 /*
@@ -75,7 +230,7 @@ void put_block(memory_block_t *block, size_t size, bool alloc) {
  */
 void *get_payload(memory_block_t *block) {
     assert(block != NULL);
-    return (void*)(block + 1);
+    return (char *)block + HEADER_SIZE;
 }
 
 /*
@@ -83,201 +238,2241 @@ void *get_payload(memory_block_t *block) {
  */
 memory_block_t *get_block(void *payload) {
     assert(payload != NULL);
-    return ((memory_block_t *)payload) - 1;
+    return (memory_block_t *)((char *)payload - HEADER_SIZE);
 }
 
+/*
+ * is_memory_block - sanity checks a header. With no magic bits to spare, it
+ * checks where the header sits and that its flags are consistent.
+ */
 bool is_memory_block(memory_block_t *block) {
     assert(block != NULL);
-    return block->block_size_alloc & 0x4 && block->block_size_alloc & 0x2;
+    if ((uintptr_t)block % ALIGNMENT != HEADER_SIZE || block->block_size_alloc & 0x8) {
+        return false;
+    }
+    return is_small(block) == (get_size(block) < TREE_MIN_SIZE);
 }
 
 /*
- *  STUDENT TODO:
- *      Describe how you select which free block to allocate. What placement strategy are you using?
- *      I chose to implement a best fit strategy, so the free block that has enough space to hold
- *      the memory we want to allocate with the least leftover is chosen.
+ * request_size - returns the size of the block that holds a payload of size
+ * bytes: the header plus the payload, rounded up so the next block stays
+ * aligned, and at least MIN_BLOCK_SIZE so the block can be freed again.
  */
+static size_t request_size(size_t size) {
+    size_t bsize = ALIGN(size + HEADER_SIZE);
+    return bsize > MIN_BLOCK_SIZE ? bsize : MIN_BLOCK_SIZE;
+}
 
 /*
- * find - finds a free block that can satisfy the umalloc request.
+ * get_class - maps a block size to the index of the free list that holds it.
+ * Small sizes each get their own exact class, larger ones are bucketed by
+ * power of two and everything past the last bucket shares the final class.
  */
-memory_block_t *find(size_t size) {
-    //? STUDENT TODO
-    memory_block_t *temp = free_head;
-    while(temp != NULL){
-        if(temp->block_size_alloc == size)
-            return temp;
-        if(temp->block_size_alloc > size + sizeof(memory_block_t))
-            return split(temp, size);
-        if(temp->block_size_alloc > size)
-            return temp;
-        temp = temp->next;
+int get_class(size_t size) {
+    assert(size >= MIN_BLOCK_SIZE);
+    if (size < MIN_BLOCK_SIZE + EXACT_CLASSES * ALIGNMENT) {
+        return (size - MIN_BLOCK_SIZE) / ALIGNMENT;
     }
-    return extend(size);
+    // the first power of two class starts at 288 (log2 = 8)
+    int cls = EXACT_CLASSES + (63 - __builtin_clzl(size)) - 8;
+    return cls < NUM_CLASSES ? cls : NUM_CLASSES - 1;
 }
 
 /*
- * extend - extends the heap if more memory is required
+ * tree_left - gets the left child of a block in the best fit tree. The child
+ * links live in the first two payload words of a free block.
  */
-memory_block_t *extend(size_t size) {
-    //? STUDENT TODO
-    int extendo = (int) (size / PAGESIZE);
-    extendo++;
-    memory_block_t *temp = (memory_block_t *)csbrk(extendo * PAGESIZE);
-    put_block(temp, extendo * PAGESIZE, false);
-    memory_block_t *fre = free_head;
-    while(fre->next != NULL){
-        fre = fre->next;
+memory_block_t *tree_left(memory_block_t *block) {
+    assert(block != NULL);
+    return ((memory_block_t **)get_payload(block))[0];
+}
+
+/*
+ * tree_right - gets the right child of a block in the best fit tree.
+ */
+memory_block_t *tree_right(memory_block_t *block) {
+    assert(block != NULL);
+    return ((memory_block_t **)get_payload(block))[1];
+}
+
+static void set_left(memory_block_t *block, memory_block_t *left) {
+    ((memory_block_t **)get_payload(block))[0] = left;
+}
+
+static void set_right(memory_block_t *block, memory_block_t *right) {
+    ((memory_block_t **)get_payload(block))[1] = right;
+}
+
+/*
+ * tree_less - orders tree nodes by size, breaking ties by address.
+ */
+static bool tree_less(memory_block_t *a, memory_block_t *b) {
+    return get_size(a) < get_size(b) || (get_size(a) == get_size(b) && a < b);
+}
+
+/*
+ * tree_priority - the heap priority of a treap node. It is a hash of the
+ * block address, so it does not need to be stored in the block.
+ */
+static uint64_t tree_priority(memory_block_t *block) {
+    uint64_t x = (uint64_t)block;
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    return x;
+}
+
+/*
+ * tree_insert - inserts a block into the treap rooted at root, rotating it up
+ * while its priority beats its parent's. Returns the new root.
+ */
+static memory_block_t *tree_insert(memory_block_t *root, memory_block_t *block) {
+    if (root == NULL) {
+        set_left(block, NULL);
+        set_right(block, NULL);
+        return block;
+    }
+    if (tree_less(block, root)) {
+        memory_block_t *left = tree_insert(tree_left(root), block);
+        if (tree_priority(left) > tree_priority(root)) {
+            set_left(root, tree_right(left));
+            set_right(left, root);
+            return left;
+        }
+        set_left(root, left);
+    }
+    else {
+        memory_block_t *right = tree_insert(tree_right(root), block);
+        if (tree_priority(right) > tree_priority(root)) {
+            set_right(root, tree_left(right));
+            set_left(right, root);
+            return right;
+        }
+        set_right(root, right);
+    }
+    return root;
+}
+
+/*
+ * tree_merge - joins two treaps where every node of a orders before every
+ * node of b. Returns the new root.
+ */
+static memory_block_t *tree_merge(memory_block_t *a, memory_block_t *b) {
+    if (a == NULL) {
+        return b;
+    }
+    if (b == NULL) {
+        return a;
+    }
+    if (tree_priority(a) > tree_priority(b)) {
+        set_right(a, tree_merge(tree_right(a), b));
+        return a;
+    }
+    set_left(b, tree_merge(a, tree_left(b)));
+    return b;
+}
+
+/*
+ * tree_remove - removes a block from the treap rooted at root by replacing it
+ * with the merge of its children. Returns the new root.
+ */
+static memory_block_t *tree_remove(memory_block_t *root, memory_block_t *block) {
+    assert(root != NULL);
+    if (root == block) {
+        return tree_merge(tree_left(block), tree_right(block));
+    }
+    if (tree_less(block, root)) {
+        set_left(root, tree_remove(tree_left(root), block));
+    }
+    else {
+        set_right(root, tree_remove(tree_right(root), block));
+    }
+    return root;
+}
+
+/*
+ * tree_search - returns the smallest block in the tree that holds at least
+ * size bytes, the lowest addressed one among equal sizes, or NULL.
+ */
+static memory_block_t *tree_search(size_t size) {
+    memory_block_t *best = NULL;
+    memory_block_t *cur = thread_arena->free_tree;
+    while (cur != NULL) {
+        if (get_size(cur) >= size) {
+            best = cur;
+            cur = tree_left(cur);
+        }
+        else {
+            cur = tree_right(cur);
+        }
+    }
+    return best;
+}
+
+/*
+ * in_tree - returns true if free blocks of this size are indexed by the best
+ * fit tree rather than by a size class list.
+ */
+static bool in_tree(size_t size) {
+    return fit_policy == FIT_BEST && size >= TREE_MIN_SIZE;
+}
+
+/*
+ * slab_class - returns the slab class for a request, one per ALIGNMENT bytes.
+ */
+int slab_class(size_t size) {
+    return ALIGN(size) / ALIGNMENT - 1;
+}
+
+/*
+ * tlsf_mapping - maps a block size to its TLSF list. The first level is the
+ * index of the highest set bit, the second level the next TLSF_SL_BITS bits,
+ * so each power of two range is split into TLSF_SL_COUNT equal lists.
+ */
+void tlsf_mapping(size_t size, int *fl, int *sl) {
+    assert(size >= MIN_BLOCK_SIZE);
+    *fl = 63 - __builtin_clzl(size);
+    *sl = (size >> (*fl - TLSF_SL_BITS)) & (TLSF_SL_COUNT - 1);
+}
+
+/*
+ * list_head - gets the head of the list a free block of this size goes on.
+ */
+static memory_block_t **list_head(size_t size) {
+    if (fit_policy == FIT_TLSF) {
+        int fl, sl;
+        tlsf_mapping(size, &fl, &sl);
+        return &thread_arena->tlsf_lists[fl][sl];
+    }
+    return &thread_arena->free_lists[get_class(size)];
+}
+
+/*
+ * push_free - pushes a free block onto the head of its size class list, or
+ * into the best fit tree when it belongs there.
+ */
+void push_free(memory_block_t *block) {
+    assert(block != NULL);
+    assert(!is_allocated(block));
+    if (in_tree(get_size(block))) {
+        block->next = NULL;
+        thread_arena->free_tree = tree_insert(thread_arena->free_tree, block);
+        return;
+    }
+    memory_block_t **head = list_head(get_size(block));
+    block->next = *head;
+    set_prev(block, NULL);
+    if (*head != NULL) {
+        set_prev(*head, block);
+    }
+    *head = block;
+    if (fit_policy == FIT_TLSF) {
+        int fl, sl;
+        tlsf_mapping(get_size(block), &fl, &sl);
+        thread_arena->tlsf_fl_bitmap |= 1ULL << fl;
+        thread_arena->tlsf_sl_bitmap[fl] |= 1U << sl;
     }
-    fre->next = temp;
-    return find(size);
+}
+
+/*
+ * remove_free - unlinks a free block from its size class list or the tree.
+ */
+void remove_free(memory_block_t *block) {
+    assert(block != NULL);
+    if (in_tree(get_size(block))) {
+        thread_arena->free_tree = tree_remove(thread_arena->free_tree, block);
+        return;
+    }
+    memory_block_t *prev = get_prev(block);
+    if (prev != NULL) {
+        prev->next = block->next;
+    }
+    else {
+        memory_block_t **head = list_head(get_size(block));
+        assert(*head == block);
+        *head = block->next;
+        if (*head == NULL && fit_policy == FIT_TLSF) {
+            int fl, sl;
+            tlsf_mapping(get_size(block), &fl, &sl);
+            thread_arena->tlsf_sl_bitmap[fl] &= ~(1U << sl);
+            if (thread_arena->tlsf_sl_bitmap[fl] == 0) {
+                thread_arena->tlsf_fl_bitmap &= ~(1ULL << fl);
+            }
+        }
+    }
+    if (block->next != NULL) {
+        set_prev(block->next, prev);
+    }
+    block->next = NULL;
 }
 
 /*
  *  STUDENT TODO:
- *      Describe how you chose to split allocated blocks. Always? Sometimes? Never? Which end?
- *      I chose to split the blocks when there was enough space to add the size requested from malloc
- *      a memory_block_t struct.
- *      Otherwise there would be no split and the extra space would be added to the payload returned by
- *      malloc.
-*/
+ *      Describe how you select which free block to allocate. What placement strategy are you using?
+ *      Segregated fit by default. The search starts at the size class of the request; in the exact
+ *      classes the head of the list always fits, in the power of two classes the first
+ *      block that is large enough is taken. Any block in a higher class always fits, so
+ *      only the first non-empty list can need more than one step.
+ *      With FIT_BEST the exact classes are used the same way (their heads are already a best
+ *      fit) and everything from TREE_MIN_SIZE up is kept in a treap ordered by size then
+ *      address, so the smallest block that fits is found in O(log n).
+ *      With FIT_TLSF the request is rounded up to the next second level boundary, so the
+ *      head of any list at or above it fits, and two bit scans over the bitmaps find that
+ *      list. No list is ever walked, which bounds every search to a few instructions.
+ */
 
 /*
- * split - splits a given block in parts, one allocated, one free.
+ * find_tlsf - good fit search used under FIT_TLSF.
  */
-memory_block_t *split(memory_block_t *block, size_t size) {
-    //? STUDENT TODO
-    block->block_size_alloc = get_size(block) - size;
-    deallocate(block);
-    block->block_size_alloc |= 0x4;
-    block->block_size_alloc |= 0x2;
-    int sizzurp = (int)(get_size(block)/ALIGNMENT);
-    memory_block_t *mllc = block + sizzurp;
-    put_block(mllc, size, true);
-    return mllc;
+static memory_block_t *find_tlsf(size_t size) {
+    int fl, sl;
+    tlsf_mapping(size, &fl, &sl);
+    //round up to the next list so that any block found is large enough
+    size_t rounded = size + (1UL << (fl - TLSF_SL_BITS)) - 1;
+    tlsf_mapping(rounded, &fl, &sl);
+    arena_t *arena = thread_arena;
+    uint32_t sl_map = arena->tlsf_sl_bitmap[fl] & (~0U << sl);
+    if (sl_map == 0) {
+        uint64_t fl_map = fl + 1 < TLSF_FL_COUNT ? arena->tlsf_fl_bitmap & (~0ULL << (fl + 1)) : 0;
+        if (fl_map == 0) {
+            return NULL;
+        }
+        fl = __builtin_ctzl(fl_map);
+        sl_map = arena->tlsf_sl_bitmap[fl];
+    }
+    sl = __builtin_ctz(sl_map);
+    memory_block_t *block = arena->tlsf_lists[fl][sl];
+    assert(block != NULL && get_size(block) >= size);
+    remove_free(block);
+    return block;
 }
 
 /*
- * coalesce - coalesces a free memory block with neighbors.
+ * find_best - best fit search used under FIT_BEST.
  */
-memory_block_t *coalesce(memory_block_t *block) {
-    //? STUDENT TODO
-    uint64_t end = (uint64_t)block + get_size(block);
-    //if(block->next == NULL)
-    //    return block;
-
-    //coalesces free block after current block
-    if(end == (uint64_t)block->next){
-        block->block_size_alloc += get_size(block->next);
-        block->block_size_alloc |= 0x4;
-        block->block_size_alloc |= 0x2;
-        block->next = block->next->next;
-    }
-
-    //coalesces free block before current block
-    memory_block_t *fre = free_head;
-    while(fre){
-        if((uint64_t)fre + get_size(fre) == (uint64_t)block){
-            fre->block_size_alloc += get_size(block);
-            fre->block_size_alloc |= 0x4;
-            fre->block_size_alloc |= 0x2;
-            fre->next = block->next;
-            break;
+static memory_block_t *find_best(size_t size) {
+    if (size < TREE_MIN_SIZE) {
+        for (int cls = get_class(size); cls < EXACT_CLASSES; cls++) {
+            memory_block_t *block = thread_arena->free_lists[cls];
+            if (block != NULL) {
+                remove_free(block);
+                return block;
+            }
         }
-        fre = fre->next;
+    }
+    memory_block_t *block = tree_search(size);
+    if (block != NULL) {
+        remove_free(block);
     }
     return block;
 }
 
+/*
+ * search - looks for a free block of at least size bytes with the selected
+ * placement policy and unlinks it. Returns NULL instead of growing the heap.
+ */
+static memory_block_t *search(size_t size) {
+    if (fit_policy == FIT_BEST) {
+        return find_best(size);
+    }
+    if (fit_policy == FIT_TLSF) {
+        return find_tlsf(size);
+    }
+    for (int cls = get_class(size); cls < NUM_CLASSES; cls++) {
+        for (memory_block_t *cur = thread_arena->free_lists[cls]; cur != NULL; cur = cur->next) {
+            if (get_size(cur) >= size) {
+                remove_free(cur);
+                return cur;
+            }
+        }
+    }
+    return NULL;
+}
 
+/*
+ * find - finds a free block that can satisfy the umalloc request. The block
+ * is unlinked from its free list before it is returned. The heap is extended
+ * when none of the free structures has one.
+ */
+memory_block_t *find(size_t size) {
+    memory_block_t *block = search(size);
+    return block != NULL ? block : extend(size);
+}
 
 /*
- * uinit - Used initialize metadata required to manage the heap
- * along with allocating initial memory.
+ * pagemap_mmap - maps bytes of zeroed memory for the page map. Returns NULL if
+ * mmap fails.
  */
-int uinit() {
-    //* STUDENT TODO
-    void *ptr = csbrk(3 * PAGESIZE);
-    free_head = (memory_block_t *)ptr;
-    put_block(free_head, 3 * PAGESIZE, false);
-    return 0;
+static void *pagemap_mmap(size_t bytes) {
+    void *ptr = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    return ptr == MAP_FAILED ? NULL : ptr;
 }
 
 /*
- * umalloc -  allocates size bytes and returns a pointer to the allocated memory.
+ * page_span - walks the page map down to the entry for ptr's page. A missing
+ * node means no page under it was ever part of the heap.
  */
-void *umalloc(size_t size) {
-    //* STUDENT TODO
-    memory_block_t *mllc;
-    //ensures size given to find() is 16 byte aligned
-    if(size % ALIGNMENT == 0){
-        mllc = find(size + sizeof(memory_block_t));
+span_t *page_span(void *ptr) {
+    uintptr_t page = (uintptr_t)ptr >> PAGE_SHIFT;
+    if ((page >> (3 * PAGEMAP_BITS)) != 0) {
+        return NULL;
     }
-    else{
-        size = size + (ALIGNMENT - (size % ALIGNMENT));
-        mllc = find(size + sizeof(memory_block_t));
+    pagemap_node_t *node = __atomic_load_n(&page_map[page >> (2 * PAGEMAP_BITS)], __ATOMIC_ACQUIRE);
+    if (node == NULL) {
+        return NULL;
     }
-    allocate(mllc);
-    //removes allocated block from free list
-    if(is_allocated(free_head)){
-        free_head = free_head->next;
-    }
-    else{
-        memory_block_t *cur = free_head;
-        memory_block_t *prev = NULL;
-        bool updated = false;
-        while(!updated && cur != NULL){
-            if(is_allocated(cur)){
-                prev->next = cur->next;
-                updated = true;
-                break;
+    pagemap_leaf_t *leaf = __atomic_load_n(&(*node)[(page >> PAGEMAP_BITS) & (PAGEMAP_FANOUT - 1)], __ATOMIC_ACQUIRE);
+    if (leaf == NULL) {
+        return NULL;
+    }
+    span_t *span = __atomic_load_n(&(*leaf)[page & (PAGEMAP_FANOUT - 1)], __ATOMIC_ACQUIRE);
+    //the page may start with the end of an earlier region
+    if (span != NULL && (uintptr_t)ptr < span->start) {
+        span = span->below;
+    }
+    return span;
+}
+
+/*
+ * map_span - points the page map entry of every page in [start, end) at span,
+ * adding nodes as they are needed. The entries are published with release
+ * stores, so a reader that finds span also sees it filled in. Returns false if
+ * a node could not be mapped, leaving the remaining pages as they were.
+ */
+static bool map_span(span_t *span, uintptr_t start, uintptr_t end) {
+    pthread_mutex_lock(&pagemap_lock);
+    for (uintptr_t page = start >> PAGE_SHIFT; page <= (end - 1) >> PAGE_SHIFT; page++) {
+        assert((page >> (3 * PAGEMAP_BITS)) == 0);
+        pagemap_node_t **node = &page_map[page >> (2 * PAGEMAP_BITS)];
+        if (*node == NULL) {
+            pagemap_node_t *fresh = pagemap_mmap(sizeof(pagemap_node_t));
+            if (fresh == NULL) {
+                pthread_mutex_unlock(&pagemap_lock);
+                return false;
             }
-            prev = cur;
-            cur = cur->next;
+            __atomic_store_n(node, fresh, __ATOMIC_RELEASE);
         }
+        pagemap_leaf_t **leaf = &(**node)[(page >> PAGEMAP_BITS) & (PAGEMAP_FANOUT - 1)];
+        if (*leaf == NULL) {
+            pagemap_leaf_t *fresh = pagemap_mmap(sizeof(pagemap_leaf_t));
+            if (fresh == NULL) {
+                pthread_mutex_unlock(&pagemap_lock);
+                return false;
+            }
+            __atomic_store_n(leaf, fresh, __ATOMIC_RELEASE);
+        }
+        __atomic_store_n(&(**leaf)[page & (PAGEMAP_FANOUT - 1)], span, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&pagemap_lock);
+    return true;
+}
 
+/*
+ * map_region - enters bytes of new memory at start in the page map. Memory that
+ * continues the arena's last region just makes its span longer, anything else
+ * gets a span of its own, linked to the region that ends in its first page and
+ * put at the head of the arena's regions. Returns false, changing nothing, if
+ * there is no memory for a new span. Pages the map cannot get memory for stay
+ * unmapped; their blocks still work, they only never hold a slab run.
+ */
+static bool map_region(void *start, size_t bytes, bool contiguous) {
+    span_t *span = thread_arena->region;
+    if (!contiguous) {
+        span_t *below = NULL;
+        if (((uintptr_t)start & (PAGESIZE - 1)) != 0) {
+            below = page_span((char *)start - 1);
+            below = below != NULL && below->kind == SPAN_REGION ? below : NULL;
+        }
+        pthread_mutex_lock(&pagemap_lock);
+        if (span_pool_left < sizeof(span_t)) {
+            span_pool = pagemap_mmap(PAGESIZE);
+            span_pool_left = span_pool == NULL ? 0 : PAGESIZE;
+        }
+        if (span_pool_left < sizeof(span_t)) {
+            pthread_mutex_unlock(&pagemap_lock);
+            return false;
+        }
+        span = (span_t *)span_pool;
+        span_pool += sizeof(span_t);
+        span_pool_left -= sizeof(span_t);
+        pthread_mutex_unlock(&pagemap_lock);
+        span->start = (uintptr_t)start;
+        span->below = below;
+        span->next = thread_arena->region;
+        span->arena_id = thread_arena->id;
+        span->kind = SPAN_REGION;
+        thread_arena->region = span;
     }
-    return get_payload(mllc);
+    span->end = (uintptr_t)start + bytes;
+    map_span(span, (uintptr_t)start, span->end);
+    return true;
 }
 
 /*
- *  STUDENT TODO:
- *      Describe your free block insertion policy.
- *      Simply frees the memory block given in the parameter by calling
- *      deallocate(). Then traverses the free head list to find the correct spot to put
- *      new free block based off of memory address. Ascending order.
-*/
+ * large_alloc - maps a block of its own for a request of size bytes, at least
+ * MMAP_THRESHOLD, with its payload at a multiple of alignment. The mapping
+ * starts with the span the page map points at for all of its pages; the block
+ * header and payload follow at the first aligned place, and the block (which
+ * is what the span describes) runs to the end of the mapping. Returns NULL if
+ * the memory cannot be mapped.
+ */
+static void *large_alloc(size_t size, size_t alignment) {
+    if (size > SIZE_MASK / 2 || alignment > SIZE_MASK / 2) {
+        return NULL;
+    }
+    size_t lead = sizeof(span_t) + HEADER_SIZE + alignment - 1;
+    //the block ends a header short of the mapping, see below
+    size_t length = (lead + ALIGN(size) + HEADER_SIZE + PAGESIZE - 1) & ~(size_t)(PAGESIZE - 1);
+    pthread_mutex_lock(&sbrk_lock);
+    char *base = cmmap(length);
+    pthread_mutex_unlock(&sbrk_lock);
+    if (base == NULL) {
+        return NULL;
+    }
+    uintptr_t payload = ((uintptr_t)base + sizeof(span_t) + HEADER_SIZE + alignment - 1) & ~(uintptr_t)(alignment - 1);
+    memory_block_t *block = get_block((void *)payload);
+    span_t *span = (span_t *)base;
+    span->start = (uintptr_t)block;
+    span->end = (uintptr_t)base + length;
+    span->below = NULL;
+    span->arena_id = 0;
+    span->kind = SPAN_LARGE;
+    //the header is 8 bytes off a 16 byte boundary and the mapping ends on a page,
+    //so the block stops 8 bytes short of the end
+    put_block(block, (span->end - span->start) & ~(uintptr_t)(ALIGNMENT - 1), true, true);
+    if (!map_span(span, (uintptr_t)base, span->end)) {
+        pthread_mutex_lock(&sbrk_lock);
+        cmunmap(base, length);
+        pthread_mutex_unlock(&sbrk_lock);
+        return NULL;
+    }
+    return (void *)payload;
+}
 
 /*
- * ufree -  frees the memory space pointed to by ptr, which must have been called
- * by a previous call to malloc.
+ * large_free - unmaps a large block, after taking its pages out of the page map.
  */
-void ufree(void *ptr) {
-    //* STUDENT TODO
-    memory_block_t *temp = get_block(ptr);
-    memory_block_t *fre = free_head;
-    deallocate(temp);
-    uint64_t end = (uint64_t)temp;
-    //find correct spot to put newly freed block
-    if(end < (uint64_t)free_head){
-        temp->next = free_head;
-        free_head = temp;
-    }
-    else{
-        bool passed = false;
-        while(fre != NULL && fre->next != NULL){
-            if((uint64_t)fre < end && (uint64_t)fre->next > end){
-                temp->next = fre->next;
-                fre = temp;
-                passed = true;
-                break;
+static void large_free(span_t *span) {
+    size_t length = span->end - (uintptr_t)span;
+    map_span(NULL, (uintptr_t)span, span->end);
+    pthread_mutex_lock(&sbrk_lock);
+    cmunmap(span, length);
+    pthread_mutex_unlock(&sbrk_lock);
+}
+
+/*
+ * arena_sbrk - grows the heap for the current arena. csbrk() is shared by all
+ * arenas, so calls are serialized.
+ */
+static void *arena_sbrk(size_t bytes) {
+    pthread_mutex_lock(&sbrk_lock);
+    void *ptr = csbrk(bytes);
+    pthread_mutex_unlock(&sbrk_lock);
+    return ptr;
+}
+
+/*
+ * init_region - lays out a freshly sbrk'd region between two zero sized,
+ * allocated sentinels: a prologue header, which also puts the first payload on
+ * a 16 byte boundary, and an epilogue header. Everything in between is one
+ * free block, marked as having an allocated predecessor so coalescing never
+ * looks before it. Returns NULL if the region cannot be given a span, in which
+ * case the memory goes back to csbrk() if nothing has been sbrk'd after it.
+ */
+static memory_block_t *init_region(void *start, size_t bytes) {
+    if (!map_region(start, bytes, false)) {
+        pthread_mutex_lock(&sbrk_lock);
+        if (sbrk(0) == (char *)start + bytes) {
+            csbrk(-(intptr_t)bytes);
+        }
+        pthread_mutex_unlock(&sbrk_lock);
+        return NULL;
+    }
+    put_block((memory_block_t *)start, 0, true, true);
+    memory_block_t *block = (memory_block_t *)((char *)start + PROLOGUE_SIZE);
+    put_block(block, bytes - PROLOGUE_SIZE - EPILOGUE_SIZE, false, true);
+    set_zeroed(block);
+    put_block(next_block(block), 0, true, false);
+    thread_arena->heap_end = (char *)start + bytes;
+    return block;
+}
+
+/*
+ * grow_bytes - rounds the need bytes extend() is short of up to a multiple of
+ * the growth quantum, unless that would ask csbrk() for more than it takes at
+ * once. With geometric growth the k-th extend since a block was last freed
+ * asks for at least 2^k quanta, up to what csbrk() takes at once.
+ */
+static size_t grow_bytes(size_t need) {
+    size_t bytes = (need + grow_quantum - 1) / grow_quantum * grow_quantum;
+    //a large quantum can round a request that csbrk() would take past what it takes
+    if (bytes > CSBRK_MAX) {
+        bytes = need;
+    }
+    if (grow_geometric) {
+        int streak = thread_arena->grow_streak++;
+        size_t burst = streak < 16 ? grow_quantum << streak : CSBRK_MAX;
+        burst = burst < CSBRK_MAX ? burst : CSBRK_MAX;
+        bytes = bytes > burst ? bytes : burst;
+    }
+    return bytes;
+}
+
+/*
+ * extend - extends the heap if more memory is required. Returns the new free
+ * block without linking it into any free list.
+ */
+memory_block_t *extend(size_t size) {
+    size = size < MIN_BLOCK_SIZE ? MIN_BLOCK_SIZE : size;
+    for (;;) {
+        //new memory right after the arena's last region joins it, along with a free
+        //block at its end, so only what that block lacks has to be requested
+        size_t need = size + PROLOGUE_SIZE + EPILOGUE_SIZE;
+        void *heap_end = thread_arena->heap_end;
+        if (heap_end != NULL && sbrk(0) == heap_end) {
+            memory_block_t *epilogue = (memory_block_t *)((char *)heap_end - EPILOGUE_SIZE);
+            memory_block_t *tail = is_prev_alloc(epilogue) ? NULL : prev_block(epilogue);
+            size_t have = tail == NULL ? 0 : get_size(tail);
+            if (have >= size) {
+                remove_free(tail);
+                return tail;
+            }
+            need = size - have;
+        }
+        size_t bytes = grow_bytes(need);
+        void *ptr = arena_sbrk(bytes);
+        if (ptr == NULL) {
+            return NULL;
+        }
+        memory_block_t *block;
+        if (ptr != heap_end) {
+            //something else owns the memory in between, so this is a region of its own
+            block = init_region(ptr, bytes);
+            if (block == NULL) {
+                return NULL;
             }
-            fre = fre->next;
         }
-        //if no spot is found it must be the last element according to memory address
-        if(!passed){
-            fre->next = temp;
+        else {
+            //nothing else moved the break since this arena's last region, so the old
+            //epilogue becomes the header of the new block, which merges with the tail
+            block = (memory_block_t *)((char *)ptr - EPILOGUE_SIZE);
+            put_block(block, bytes, false, is_prev_alloc(block));
+            set_zeroed(block);
+            put_block(next_block(block), 0, true, false);
+            thread_arena->heap_end = (char *)ptr + bytes;
+            map_region(ptr, bytes, true);
+            block = coalesce(block);
+        }
+        if (get_size(block) >= size) {
+            return block;
         }
+        //another thread moved the break after we looked, so nothing merged
+        push_free(block);
+    }
+}
+
+/*
+ *  STUDENT TODO:
+ *      Describe how you chose to split allocated blocks. Always? Sometimes? Never? Which end?
+ *      A block is split whenever the leftover is at least split_min bytes, MIN_BLOCK_SIZE
+ *      unless M_SPLIT_MIN raises it. The free remainder goes back onto the list for its
+ *      new size class. By default the allocation is placed at the high end and the
+ *      remainder keeps the low addresses; M_SPLIT_POLICY can place it at the low end
+ *      instead, or pick the end by size: small blocks from the high end, larger ones
+ *      from the low end, so the two gather apart and a large block freed next to
+ *      another large one merges with it.
+ *      Otherwise there would be no split and the extra space would be added to the payload returned by
+ *      malloc.
+ *      Requests of up to SLAB_MAX_SIZE bytes mostly come from slab runs and never
+ *      reach split(), so where those are the only small requests, as in binary2-bal,
+ *      every policy places the blocks the same way.
+*/
+
+/*
+ * split - splits a given block in parts, one allocated, one free, placing the
+ * allocated part at the end split_policy picks for its size.
+ */
+memory_block_t *split(memory_block_t *block, size_t size) {
+    size_t remainder = get_size(block) - size;
+    if (remainder < split_min) {
+        return block;
     }
-    coalesce(temp);
-}
\ No newline at end of file
+    bool zeroed = is_zeroed(block);
+    memory_block_t *mllc;
+    memory_block_t *rest;
+    if (split_policy == SPLIT_LOW || (split_policy == SPLIT_BY_SIZE && size >= TREE_MIN_SIZE)) {
+        mllc = block;
+        put_block(mllc, size, true, is_prev_alloc(block));
+        rest = next_block(mllc);
+        put_block(rest, remainder, false, true);
+    }
+    else {
+        rest = block;
+        put_block(rest, remainder, false, is_prev_alloc(block));
+        mllc = next_block(rest);
+        put_block(mllc, size, true, false);
+    }
+    //the new header and footer land in metadata or zeroed payload, so a block
+    //fresh from csbrk stays zeroed on both sides
+    if (zeroed) {
+        set_zeroed(rest);
+        set_zeroed(mllc);
+    }
+    push_free(rest);
+    return mllc;
+}
+
+/*
+ * coalesce - coalesces a free memory block with neighbors. The block must not
+ * be on a free list; any neighbor that is merged in is unlinked from its own
+ * list, and the merged block is returned unlinked. The sentinels keep merges
+ * inside the block's region, even when another region sits right next to it:
+ * the prologue is allocated, and so is the epilogue.
+ */
+memory_block_t *coalesce(memory_block_t *block) {
+    //the next header is found from our size, the previous block from its footer
+    memory_block_t *next = next_block(block);
+    if (!is_allocated(next)) {
+        remove_free(next);
+        put_block(block, get_size(block) + get_size(next), false, is_prev_alloc(block));
+    }
+    if (!is_prev_alloc(block)) {
+        memory_block_t *prev = prev_block(block);
+        remove_free(prev);
+        put_block(prev, get_size(prev) + get_size(block), false, is_prev_alloc(prev));
+        block = prev;
+    }
+    return block;
+}
+
+
+
+/*
+ * consolidate - frees every block on the current arena's quick lists for real,
+ * merging each with its free neighbors. Returns false if there were none.
+ * The arena lock must be held.
+ */
+static bool consolidate(void) {
+    arena_t *arena = thread_arena;
+    if (arena->quick_bytes == 0) {
+        return false;
+    }
+    for (int bin = 0; bin < QUICK_BINS; bin++) {
+        memory_block_t *block = arena->quick_lists[bin];
+        arena->quick_lists[bin] = NULL;
+        while (block != NULL) {
+            //a neighbor still on a quick list looks allocated, and merges once its own turn comes
+            memory_block_t *next = block->next;
+            put_block(block, get_size(block), false, is_prev_alloc(block));
+            set_prev_alloc(next_block(block), false);
+            push_free(coalesce(block));
+            block = next;
+        }
+    }
+    arena->quick_bytes = 0;
+    return true;
+}
+
+/*
+ * quick_push - defers freeing a block below QUICK_MAX_SIZE: it stays marked
+ * allocated, so nothing coalesces with it, and waits on the quick list for its
+ * exact size, linked through next. Once the lists hold more
+ * than QUICK_LIMIT bytes they are consolidated. The arena lock must be held.
+ */
+static void quick_push(memory_block_t *block) {
+    arena_t *arena = thread_arena;
+    int bin = (get_size(block) - MIN_BLOCK_SIZE) / ALIGNMENT;
+    block->next = arena->quick_lists[bin];
+    arena->quick_lists[bin] = block;
+    arena->quick_bytes += get_size(block);
+    if (arena->quick_bytes > QUICK_LIMIT) {
+        consolidate();
+    }
+}
+
+/*
+ * quick_pop - takes a block of exactly size bytes off the current arena's quick
+ * lists, ready to use as it is. Returns NULL if there is none. The arena lock
+ * must be held.
+ */
+static memory_block_t *quick_pop(size_t size) {
+    arena_t *arena = thread_arena;
+    if (size >= QUICK_MAX_SIZE || arena->quick_bytes == 0) {
+        return NULL;
+    }
+    int bin = (size - MIN_BLOCK_SIZE) / ALIGNMENT;
+    memory_block_t *block = arena->quick_lists[bin];
+    if (block != NULL) {
+        arena->quick_lists[bin] = block->next;
+        arena->quick_bytes -= size;
+        block->next = NULL;
+    }
+    return block;
+}
+
+/*
+ * search_consolidated - search(), trying again after consolidating the quick
+ * lists if nothing fits, before the caller has to grow the heap.
+ */
+static memory_block_t *search_consolidated(size_t size) {
+    memory_block_t *block = search(size);
+    if (block == NULL && consolidate()) {
+        block = search(size);
+    }
+    return block;
+}
+
+/*
+ * alloc_block - takes a block of exactly size bytes (or a little more when the
+ * leftover is too small to split off) from the current arena and stamps it with
+ * the arena's id. If zeroed is not NULL it is set to whether the payload was
+ * still zero from csbrk. The arena lock must be held.
+ */
+static memory_block_t *alloc_block(size_t size, bool *zeroed) {
+    memory_block_t *mllc = quick_pop(size);
+    if (mllc != NULL) {
+        if (zeroed != NULL) {
+            *zeroed = false;
+        }
+        return mllc;
+    }
+    mllc = search_consolidated(size);
+    if (mllc == NULL) {
+        mllc = extend(size);
+    }
+    if (mllc == NULL) {
+        return NULL;
+    }
+    mllc = split(mllc, size);
+    if (zeroed != NULL) {
+        *zeroed = is_zeroed(mllc);
+    }
+    mllc->block_size_alloc &= ~ZEROED;
+    allocate(mllc);
+    mllc->block_size_alloc |= (size_t)thread_arena->id << ARENA_SHIFT;
+    set_prev_alloc(next_block(mllc), true);
+    return mllc;
+}
+
+/*
+ * carve_low - allocates the low size bytes of an unlinked free block and
+ * gives the leftover, if it is big enough to be a block, back to the arena.
+ * The arena lock must be held.
+ */
+static memory_block_t *carve_low(memory_block_t *mllc, size_t size) {
+    size_t remainder = get_size(mllc) - size;
+    if (remainder < MIN_BLOCK_SIZE) {
+        size = get_size(mllc);
+    }
+    put_block(mllc, size, true, is_prev_alloc(mllc));
+    mllc->block_size_alloc |= (size_t)thread_arena->id << ARENA_SHIFT;
+    if (remainder < MIN_BLOCK_SIZE) {
+        set_prev_alloc(next_block(mllc), true);
+    }
+    else {
+        memory_block_t *tail = next_block(mllc);
+        put_block(tail, remainder, false, true);
+        push_free(tail);
+    }
+    return mllc;
+}
+
+/*
+ * alloc_block_low - like alloc_block, but places the block at the low end of
+ * the free block it is carved from, so the leftover sits right after it. Used
+ * when urealloc has to move a block, leaving it room to grow in place next time;
+ * when the heap has to be extended for it, a page (or growth quantum, if that is
+ * larger) of room is added.
+ * The arena lock must be held.
+ */
+static memory_block_t *alloc_block_low(size_t size) {
+    memory_block_t *mllc = search_consolidated(size);
+    if (mllc == NULL) {
+        //the room is cut short where it would take the extend past what csbrk() supplies
+        size_t room = grow_quantum > PAGESIZE ? grow_quantum : PAGESIZE;
+        size_t most = CSBRK_MAX - PROLOGUE_SIZE - EPILOGUE_SIZE;
+        if (size + room > most) {
+            room = size < most ? most - size : 0;
+        }
+        mllc = extend(size + room);
+    }
+    return mllc == NULL ? NULL : carve_low(mllc, size);
+}
+
+/*
+ * aligned_lead - returns how far into a free block the header of an aligned
+ * block of size bytes can go, leaving either nothing or a whole block on each
+ * side of it. The highest such place is preferred, like split() allocates from
+ * the high end, so the free part in front stays in one piece. Returns
+ * SIZE_MAX if the block has no such place.
+ */
+static size_t aligned_lead(memory_block_t *block, size_t alignment, size_t size) {
+    uintptr_t start = (uintptr_t)block;
+    uintptr_t end = start + get_size(block);
+    if (end - start < size) {
+        return SIZE_MAX;
+    }
+    uintptr_t header = ((end - size + HEADER_SIZE) & ~(uintptr_t)(alignment - 1)) - HEADER_SIZE;
+    if (end - header - size != 0 && end - header - size < MIN_BLOCK_SIZE) {
+        header -= alignment;
+    }
+    if (header >= start && (header == start || header - start >= MIN_BLOCK_SIZE)) {
+        return header - start;
+    }
+    //otherwise the lowest place, carve_low() deals with whatever is left after it
+    header = ((start + HEADER_SIZE + alignment - 1) & ~(uintptr_t)(alignment - 1)) - HEADER_SIZE;
+    if (header != start && header - start < MIN_BLOCK_SIZE) {
+        header += alignment;
+    }
+    return header + size <= end ? header - start : SIZE_MAX;
+}
+
+/*
+ * alloc_block_aligned - takes a block of size bytes whose payload is a multiple
+ * of alignment (a power of two above ALIGNMENT). Any slack before or after the
+ * aligned block goes back to the free structures. The block found is first one
+ * that merely fits, and if that has no aligned place, one large enough to have
+ * one wherever it lies. The arena lock must be held.
+ */
+static memory_block_t *alloc_block_aligned(size_t alignment, size_t size) {
+    memory_block_t *block = search_consolidated(size);
+    if (block != NULL && aligned_lead(block, alignment, size) == SIZE_MAX) {
+        push_free(block);
+        block = NULL;
+    }
+    if (block == NULL) {
+        block = find(size + alignment + MIN_BLOCK_SIZE);
+    }
+    if (block == NULL) {
+        return NULL;
+    }
+    size_t lead = aligned_lead(block, alignment, size);
+    if (lead != 0) {
+        size_t total = get_size(block);
+        put_block(block, lead, false, is_prev_alloc(block));
+        push_free(block);
+        block = next_block(block);
+        put_block(block, total - lead, false, false);
+    }
+    return carve_low(block, size);
+}
+
+/*
+ * trim_block - lowers the break to give back the end of a free block that is not
+ * on any free list, when the block ends the arena's last region, nothing else
+ * has moved the break since, and at least min bytes would go. The block keeps
+ * a minimal size and the break stays page aligned, so memory grown back later
+ * is still fresh from the kernel. Returns true if the heap shrank. The arena
+ * lock must be held.
+ */
+static bool trim_block(memory_block_t *block, size_t min) {
+    char *heap_end = thread_arena->heap_end;
+    memory_block_t *epilogue = next_block(block);
+    if ((char *)epilogue + EPILOGUE_SIZE != heap_end) {
+        return false;
+    }
+    uintptr_t new_end = ((uintptr_t)block + MIN_BLOCK_SIZE + EPILOGUE_SIZE + PAGESIZE - 1) & ~(uintptr_t)(PAGESIZE - 1);
+    if ((uintptr_t)heap_end < new_end + min) {
+        return false;
+    }
+    bool trimmed = false;
+    pthread_mutex_lock(&sbrk_lock);
+    if (sbrk(0) == heap_end && csbrk(-(intptr_t)((uintptr_t)heap_end - new_end)) != NULL) {
+        trimmed = true;
+    }
+    pthread_mutex_unlock(&sbrk_lock);
+    if (!trimmed) {
+        return false;
+    }
+    bool zeroed = is_zeroed(block);
+    put_block(block, new_end - EPILOGUE_SIZE - (uintptr_t)block, false, is_prev_alloc(block));
+    if (zeroed) {
+        set_zeroed(block);
+    }
+    put_block(next_block(block), 0, true, false);
+    thread_arena->heap_end = (void *)new_end;
+    thread_arena->region->end = new_end;
+    map_span(NULL, new_end, (uintptr_t)heap_end);
+    return true;
+}
+
+/*
+ * purge_block - hands the whole pages inside a large free block back to the
+ * kernel with madvise(), and zeroes the rest of the payload around them so the
+ * block can be marked zeroed. Unless force is set, a block is only purged once
+ * a sweep has found it free before, which put_block() forgets. Returns true if
+ * the block was purged.
+ */
+static bool purge_block(memory_block_t *block, bool force) {
+    if (get_size(block) < PURGE_MIN_SIZE || is_zeroed(block)) {
+        return false;
+    }
+    if (!force && !(block->block_size_alloc & PURGE_SEEN)) {
+        block->block_size_alloc |= PURGE_SEEN;
+        return false;
+    }
+    //the header, the two link words and the footer stay in place
+    char *start = (char *)get_payload(block) + 2 * sizeof(memory_block_t *);
+    char *end = (char *)block + get_size(block) - sizeof(size_t);
+    char *lo = (char *)(((uintptr_t)start + PAGESIZE - 1) & ~(uintptr_t)(PAGESIZE - 1));
+    char *hi = (char *)((uintptr_t)end & ~(uintptr_t)(PAGESIZE - 1));
+    madvise(lo, hi - lo, MADV_DONTNEED);
+    memset(start, 0, lo - start);
+    memset(hi, 0, end - hi);
+    block->block_size_alloc &= ~PURGE_SEEN;
+    set_zeroed(block);
+    return true;
+}
+
+/*
+ * purge_tree - runs purge_block() on every node of a best fit subtree. Purging
+ * leaves block sizes alone, so the tree order holds.
+ */
+static bool purge_tree(memory_block_t *node, bool force) {
+    if (node == NULL) {
+        return false;
+    }
+    bool purged = purge_block(node, force);
+    purged |= purge_tree(tree_left(node), force);
+    return purge_tree(tree_right(node), force) || purged;
+}
+
+/*
+ * purge_sweep - runs purge_block() on every free block of the current arena
+ * that is large enough to be purged. Returns true if any block was purged.
+ * The arena lock must be held.
+ */
+static bool purge_sweep(bool force) {
+    arena_t *arena = thread_arena;
+    bool purged = purge_tree(arena->free_tree, force);
+    for (int cls = get_class(PURGE_MIN_SIZE); cls < NUM_CLASSES; cls++) {
+        for (memory_block_t *cur = arena->free_lists[cls]; cur != NULL; cur = cur->next) {
+            purged |= purge_block(cur, force);
+        }
+    }
+    int min_fl, min_sl;
+    tlsf_mapping(PURGE_MIN_SIZE, &min_fl, &min_sl);
+    for (int fl = min_fl; fl < TLSF_FL_COUNT; fl++) {
+        for (int sl = 0; sl < TLSF_SL_COUNT; sl++) {
+            for (memory_block_t *cur = arena->tlsf_lists[fl][sl]; cur != NULL; cur = cur->next) {
+                purged |= purge_block(cur, force);
+            }
+        }
+    }
+    return purged;
+}
+
+/*
+ * purge_decayed - counts a free to the current arena and, every PURGE_CHECK of
+ * them, sweeps its free blocks if the decay interval has passed since the last
+ * sweep. A block is purged by the first sweep to find it free a second time, so
+ * after between one and two intervals. The arena lock must be held.
+ */
+static void purge_decayed(void) {
+    arena_t *arena = thread_arena;
+    if (++arena->purge_ticks < PURGE_CHECK) {
+        return;
+    }
+    arena->purge_ticks = 0;
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    uint64_t now = (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+    if (now - arena->purge_time >= (uint64_t)decay_ms) {
+        arena->purge_time = now;
+        purge_sweep(false);
+    }
+}
+
+/*
+ * release_block - puts a coalesced free block back on the free structures,
+ * first trimming the heap under it if it is at least the trim threshold.
+ * The arena lock must be held.
+ */
+static void release_block(memory_block_t *block) {
+    if (get_size(block) >= trim_threshold) {
+        trim_block(block, trim_threshold);
+    }
+    push_free(block);
+    purge_decayed();
+}
+
+/*
+ * free_block - returns an allocated block to the current arena, merging it with
+ * its free neighbors, or with M_DEFERRED leaving a small one on a quick list.
+ * The arena lock must be held.
+ */
+static void free_block(memory_block_t *block) {
+    thread_arena->grow_streak = 0;
+    if (deferred && get_size(block) < QUICK_MAX_SIZE) {
+        quick_push(block);
+        return;
+    }
+    put_block(block, get_size(block), false, is_prev_alloc(block));
+    set_prev_alloc(next_block(block), false);
+    release_block(coalesce(block));
+}
+
+/*
+ * shrink_block - gives the tail of an allocated block beyond size bytes back to
+ * the arena, unless it is too small to be a block. split() keeps its free part
+ * at the low end, which would move the payload, so the tail is carved here.
+ * The arena lock must be held.
+ */
+static void shrink_block(memory_block_t *block, size_t size) {
+    size_t remainder = get_size(block) - size;
+    if (remainder < MIN_BLOCK_SIZE) {
+        return;
+    }
+    set_size(block, size);
+    memory_block_t *tail = next_block(block);
+    put_block(tail, remainder, false, true);
+    set_prev_alloc(next_block(tail), false);
+    push_free(coalesce(tail));
+}
+
+/*
+ * resize_block - resizes an allocated block to size bytes without moving it,
+ * by shrinking it, absorbing a free block right after it, or, when it ends the
+ * arena's last region, extending the heap. Returns false if the block has to
+ * be moved. The arena lock must be held.
+ */
+static bool resize_block(memory_block_t *block, size_t size) {
+    size_t cur = get_size(block);
+    if (size <= cur) {
+        shrink_block(block, size);
+        return true;
+    }
+    memory_block_t *next = next_block(block);
+    size_t avail = cur + (is_allocated(next) ? 0 : get_size(next));
+    if (avail >= size) {
+        remove_free(next);
+    }
+    else {
+        //only the epilogue (and maybe one free block) follows, so new pages from a
+        //contiguous extend merge into the space right after the block
+        memory_block_t *last = is_allocated(next) ? next : next_block(next);
+        if ((char *)last + EPILOGUE_SIZE != (char *)thread_arena->heap_end) {
+            return false;
+        }
+        memory_block_t *grown = extend(size - cur);
+        if (grown == NULL) {
+            return false;
+        }
+        if (grown != next) {
+            push_free(grown);
+            return false;
+        }
+    }
+    set_size(block, cur + get_size(next));
+    set_prev_alloc(next_block(block), true);
+    shrink_block(block, size);
+    return true;
+}
+
+/*
+ * get_arena - gets the arena that owns an allocated block. Only the owner may
+ * read the header without a lock, so the size bits are loaded atomically.
+ */
+static arena_t *get_arena(memory_block_t *block) {
+    size_t header = __atomic_load_n(&block->block_size_alloc, __ATOMIC_RELAXED);
+    return &arenas[header >> ARENA_SHIFT];
+}
+
+/*
+ * get_owner - gets the arena that owns the allocation at ptr from the page map,
+ * without touching the block header. Falls back to the header for a page the
+ * map holds no entry for.
+ */
+static arena_t *get_owner(span_t *span, void *ptr) {
+    return span != NULL ? &arenas[span->arena_id] : get_arena(get_block(ptr));
+}
+
+/*
+ * load_size - get_size() for an allocated block read outside the arena lock,
+ * where another thread may be updating its PREV_ALLOC bit.
+ */
+static size_t load_size(memory_block_t *block) {
+    return __atomic_load_n(&block->block_size_alloc, __ATOMIC_RELAXED) & SIZE_MASK;
+}
+
+/*
+ * remote_free - hands a block to the arena that owns it by pushing it onto that
+ * arena's remote free stack. Any number of threads may push at once; only the
+ * owner pops, and it takes the whole stack at a time, so a plain CAS suffices.
+ */
+static void remote_free(arena_t *owner, memory_block_t *block) {
+    memory_block_t *head = __atomic_load_n(&owner->remote_frees, __ATOMIC_RELAXED);
+    do {
+        block->next = head;
+    } while (!__atomic_compare_exchange_n(&owner->remote_frees, &head, block, true,
+                                          __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+/*
+ * find_slab - looks ptr's page up in the page map, where the pages of slab runs
+ * map to the run itself.
+ */
+slab_t *find_slab(void *ptr) {
+    span_t *span = page_span(ptr);
+    return span != NULL && span->kind == SPAN_SLAB ? (slab_t *)span : NULL;
+}
+
+/*
+ * slab_new_run - carves a page aligned run for a slab class out of the arena
+ * and puts it on the class list. The arena lock must be held.
+ */
+static slab_t *slab_new_run(int cls) {
+    memory_block_t *block = alloc_block_aligned(SLAB_RUN_SIZE, request_size(SLAB_RUN_SIZE));
+    if (block == NULL) {
+        return NULL;
+    }
+    slab_t *run = get_payload(block);
+    memset(run, 0, sizeof(slab_t));
+    run->span.start = (uintptr_t)run;
+    run->span.end = (uintptr_t)run + SLAB_RUN_SIZE;
+    run->span.arena_id = thread_arena->id;
+    run->span.kind = SPAN_SLAB;
+    run->region = page_span(run);
+    run->obj_size = (cls + 1) * ALIGNMENT;
+    run->nslots = (SLAB_RUN_SIZE - SLAB_HEADER) / run->obj_size;
+    run->nfree = run->nslots;
+    for (int slot = 0; slot < run->nslots; slot++) {
+        run->bitmap[slot / 64] |= 1ULL << (slot % 64);
+    }
+    //the page has a leaf already if its region was mapped, so this cannot fail then
+    if (run->region == NULL || !map_span(&run->span, run->span.start, run->span.end)) {
+        free_block(block);
+        return NULL;
+    }
+    thread_arena->slabs[cls] = run;
+    return run;
+}
+
+/*
+ * slab_unlink - takes a run off its class list.
+ */
+static void slab_unlink(slab_t **head, slab_t *run) {
+    if (run->prev != NULL) {
+        run->prev->next = run->next;
+    }
+    else {
+        *head = run->next;
+    }
+    if (run->next != NULL) {
+        run->next->prev = run->prev;
+    }
+    run->next = NULL;
+    run->prev = NULL;
+}
+
+/*
+ * slab_alloc - takes the lowest free slot of the first run on the class list,
+ * starting a new run if the list is empty. A run that fills up leaves the list.
+ * The arena lock must be held.
+ */
+static void *slab_alloc(int cls) {
+    slab_t **head = &thread_arena->slabs[cls];
+    slab_t *run = *head != NULL ? *head : slab_new_run(cls);
+    if (run == NULL) {
+        return NULL;
+    }
+    int word = 0;
+    while (run->bitmap[word] == 0) {
+        word++;
+    }
+    int bit = __builtin_ctzll(run->bitmap[word]);
+    run->bitmap[word] &= ~(1ULL << bit);
+    if (--run->nfree == 0) {
+        slab_unlink(head, run);
+    }
+    return (char *)run + SLAB_HEADER + (word * 64 + bit) * run->obj_size;
+}
+
+/*
+ * slab_free - marks an object's slot free. A run that was full goes back on its
+ * class list, and a run that becomes empty is returned to the arena unless it
+ * is the only run left on the list. The arena lock must be held.
+ */
+static void slab_free(slab_t *run, void *ptr) {
+    int cls = run->obj_size / ALIGNMENT - 1;
+    slab_t **head = &thread_arena->slabs[cls];
+    int slot = ((char *)ptr - (char *)run - SLAB_HEADER) / run->obj_size;
+    run->bitmap[slot / 64] |= 1ULL << (slot % 64);
+    if (run->nfree++ == 0) {
+        run->next = *head;
+        if (*head != NULL) {
+            (*head)->prev = run;
+        }
+        *head = run;
+    }
+    if (run->nfree == run->nslots && (run->next != NULL || run->prev != NULL)) {
+        slab_unlink(head, run);
+        map_span(run->region, run->span.start, run->span.end);
+        free_block(get_block(run));
+    }
+}
+
+/*
+ * remote_slab_free - remote_free() for a slab object, linked through its first
+ * word since it has no header.
+ */
+static void remote_slab_free(arena_t *owner, void *ptr) {
+    void *head = __atomic_load_n(&owner->remote_slab_frees, __ATOMIC_RELAXED);
+    do {
+        *(void **)ptr = head;
+    } while (!__atomic_compare_exchange_n(&owner->remote_slab_frees, &head, ptr, true,
+                                          __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+/*
+ * lock_arena - takes the current arena's lock and, since this is the slow path
+ * anyway, frees every block other threads have handed back since last time.
+ */
+static void lock_arena(void) {
+    pthread_mutex_lock(&thread_arena->lock);
+    memory_block_t *block = __atomic_exchange_n(&thread_arena->remote_frees, NULL, __ATOMIC_ACQUIRE);
+    while (block != NULL) {
+        memory_block_t *next = block->next;
+        free_block(block);
+        block = next;
+    }
+    void *ptr = __atomic_exchange_n(&thread_arena->remote_slab_frees, NULL, __ATOMIC_ACQUIRE);
+    while (ptr != NULL) {
+        void *next = *(void **)ptr;
+        slab_free(find_slab(ptr), ptr);
+        ptr = next;
+    }
+}
+
+static void unlock_arena(void) {
+    pthread_mutex_unlock(&thread_arena->lock);
+}
+
+/*
+ * init_arena - gives the current arena its first region. The arena lock must
+ * be held. Returns -1 if the heap cannot grow.
+ */
+static int init_arena(void) {
+    arena_t *arena = thread_arena;
+    void *ptr = arena_sbrk(3 * PAGESIZE);
+    if (ptr == NULL) {
+        return -1;
+    }
+    memory_block_t *block = init_region(ptr, 3 * PAGESIZE);
+    if (block == NULL) {
+        return -1;
+    }
+    push_free(block);
+    arena->initialized = true;
+    return 0;
+}
+
+/*
+ * bind_arena - binds the calling thread to an arena the first time it
+ * allocates, handing the arenas out round robin. Returns NULL if a new arena
+ * could not be set up.
+ */
+static arena_t *bind_arena(void) {
+    if (thread_arena != NULL) {
+        return thread_arena;
+    }
+    unsigned index = __atomic_fetch_add(&next_arena, 1, __ATOMIC_RELAXED) % num_arenas;
+    thread_arena = &arenas[index];
+    pthread_mutex_lock(&thread_arena->lock);
+    int ret = thread_arena->initialized ? 0 : init_arena();
+    pthread_mutex_unlock(&thread_arena->lock);
+    if (ret == -1) {
+        thread_arena = NULL;
+    }
+    return thread_arena;
+}
+
+/*
+ * tcache_flush - returns up to count blocks from one bin of this thread's cache
+ * to its arena under a single acquisition of the arena lock.
+ */
+static void tcache_flush(int bin, int count) {
+    lock_arena();
+    while (count-- > 0 && tcache.bins[bin] != NULL) {
+        memory_block_t *block = tcache.bins[bin];
+        tcache.bins[bin] = block->next;
+        tcache.counts[bin]--;
+        free_block(block);
+    }
+    unlock_arena();
+}
+
+/*
+ * tcache_slab_flush - tcache_flush() for a bin of slab objects.
+ */
+static void tcache_slab_flush(int cls, int count) {
+    lock_arena();
+    while (count-- > 0 && tcache.slab_bins[cls] != NULL) {
+        void *ptr = tcache.slab_bins[cls];
+        tcache.slab_bins[cls] = *(void **)ptr;
+        tcache.slab_counts[cls]--;
+        slab_free(find_slab(ptr), ptr);
+    }
+    unlock_arena();
+}
+
+/*
+ * tcache_destroy - thread exit hook that hands every cached block back.
+ */
+static void tcache_destroy(void *unused) {
+    for (int bin = 0; bin < TCACHE_BINS; bin++) {
+        tcache_flush(bin, tcache.counts[bin]);
+    }
+    for (int cls = 0; cls < SLAB_CLASSES; cls++) {
+        tcache_slab_flush(cls, tcache.slab_counts[cls]);
+    }
+}
+
+static void tcache_make_key(void) {
+    pthread_key_create(&tcache_key, tcache_destroy);
+}
+
+/*
+ * tcache_register - arranges for this thread's cache to be flushed when the
+ * thread exits, the first time anything is cached.
+ */
+static void tcache_register(void) {
+    if (!tcache.registered) {
+        pthread_once(&tcache_once, tcache_make_key);
+        pthread_setspecific(tcache_key, &tcache);
+        tcache.registered = true;
+    }
+}
+
+/*
+ * tcache_push - caches an allocated block in this thread's bin for its size.
+ * The block stays marked allocated so the heap never coalesces it, and it is
+ * linked through next, the first word of its payload.
+ * Only blocks owned by this thread's arena are ever cached.
+ */
+static void tcache_push(int bin, memory_block_t *block) {
+    tcache_register();
+    block->next = tcache.bins[bin];
+    tcache.bins[bin] = block;
+    tcache.counts[bin]++;
+}
+
+/*
+ * tcache_refill - takes TCACHE_BATCH blocks of the given size from the arena
+ * under a single acquisition of its lock. One is returned, the rest are
+ * cached. A cached block may be up to a class larger than size, when its
+ * leftover was too small to split off; a raised split_min can hand back larger
+ * ones, which go back to the heap and end the refill.
+ */
+static memory_block_t *tcache_refill(int bin, size_t size) {
+    lock_arena();
+    memory_block_t *mllc = alloc_block(size, NULL);
+    for (int i = 1; mllc != NULL && i < TCACHE_BATCH; i++) {
+        memory_block_t *block = alloc_block(size, NULL);
+        if (block == NULL) {
+            break;
+        }
+        if (get_size(block) >= size + MIN_BLOCK_SIZE) {
+            free_block(block);
+            break;
+        }
+        tcache_push(bin, block);
+    }
+    unlock_arena();
+    return mllc;
+}
+
+/*
+ * slab_cache_alloc - takes a slab object of class cls from this thread's cache,
+ * refilling the bin with TCACHE_BATCH objects under one acquisition of the
+ * arena lock when it is empty. Returns NULL if no run could be set up.
+ */
+static void *slab_cache_alloc(int cls) {
+    void *ptr = tcache.slab_bins[cls];
+    if (ptr != NULL) {
+        tcache.slab_bins[cls] = *(void **)ptr;
+        tcache.slab_counts[cls]--;
+        return ptr;
+    }
+    lock_arena();
+    ptr = slab_alloc(cls);
+    for (int i = 1; ptr != NULL && i < TCACHE_BATCH; i++) {
+        void *extra = slab_alloc(cls);
+        if (extra == NULL) {
+            break;
+        }
+        tcache_register();
+        *(void **)extra = tcache.slab_bins[cls];
+        tcache.slab_bins[cls] = extra;
+        tcache.slab_counts[cls]++;
+    }
+    unlock_arena();
+    return ptr;
+}
+
+/*
+ * slab_cache_free - frees a slab object into this thread's cache, or hands it
+ * to the arena that owns its run.
+ */
+static void slab_cache_free(slab_t *run, void *ptr) {
+    arena_t *owner = &arenas[run->span.arena_id];
+    if (owner != bind_arena()) {
+        remote_slab_free(owner, ptr);
+        return;
+    }
+    int cls = run->obj_size / ALIGNMENT - 1;
+    if (tcache.slab_counts[cls] >= TCACHE_COUNT) {
+        tcache_slab_flush(cls, TCACHE_BATCH);
+    }
+    tcache_register();
+    *(void **)ptr = tcache.slab_bins[cls];
+    tcache.slab_bins[cls] = ptr;
+    tcache.slab_counts[cls]++;
+}
+
+/*
+ * uinit - Used initialize metadata required to manage the heap
+ * along with allocating initial memory. Sets up the first arena and binds
+ * the calling thread to it; the others are set up by the first thread that
+ * gets bound to them. Calling it again discards the old heap, along with the
+ * calling thread's cache of its blocks, so no other thread may be using the
+ * allocator at the time.
+ */
+int uinit() {
+    if (num_arenas == 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        num_arenas = cpus < 1 ? 1 : (cpus > MAX_ARENAS ? MAX_ARENAS : cpus);
+    }
+    for (int i = 0; i < MAX_ARENAS; i++) {
+        if (arenas[i].initialized) {
+            memset(&arenas[i], 0, sizeof(arena_t));
+        }
+        pthread_mutex_init(&arenas[i].lock, NULL);
+        arenas[i].id = i;
+    }
+    //the cached blocks belong to the discarded heap; the exit key stays set
+    bool registered = tcache.registered;
+    memset(&tcache, 0, sizeof(tcache_t));
+    tcache.registered = registered;
+    next_arena = 1;
+    thread_arena = &arenas[0];
+    pthread_mutex_lock(&thread_arena->lock);
+    int ret = init_arena();
+    pthread_mutex_unlock(&thread_arena->lock);
+    return ret;
+}
+
+/*
+ * umalloc -  allocates size bytes and returns a pointer to the allocated memory.
+ * The smallest requests are slab objects without a header. Other small requests
+ * are served from this thread's cache without locking, and refill it in a batch
+ * from the thread's arena when it runs dry. Large requests bypass the arenas
+ * and get a mapping of their own.
+ */
+void *umalloc(size_t size) {
+    if (size >= MMAP_THRESHOLD) {
+        return large_alloc(size, ALIGNMENT);
+    }
+    if (size == 0 || bind_arena() == NULL) {
+        return NULL;
+    }
+    if (size <= SLAB_MAX_SIZE) {
+        //a whole run is a waste for a handful of objects, so those stay blocks
+        int cls = slab_class(size);
+        if (tcache.slab_requests[cls] >= SLAB_THRESHOLD) {
+            void *ptr = slab_cache_alloc(cls);
+            if (ptr != NULL) {
+                return ptr;
+            }
+        }
+        else {
+            tcache.slab_requests[cls]++;
+        }
+    }
+    size_t bsize = request_size(size);
+    memory_block_t *mllc;
+    if (bsize < TCACHE_MAX_SIZE) {
+        int bin = get_class(bsize);
+        mllc = tcache.bins[bin];
+        if (mllc != NULL) {
+            tcache.bins[bin] = mllc->next;
+            tcache.counts[bin]--;
+            mllc->next = NULL;
+            return get_payload(mllc);
+        }
+        mllc = tcache_refill(bin, bsize);
+    }
+    else {
+        lock_arena();
+        mllc = alloc_block(bsize, NULL);
+        unlock_arena();
+    }
+    return mllc == NULL ? NULL : get_payload(mllc);
+}
+
+/*
+ * umemalign - allocates size bytes whose address is a multiple of alignment,
+ * which must be a power of two. The block is an ordinary one, so it is freed
+ * with ufree().
+ */
+void *umemalign(size_t alignment, size_t size) {
+    if (alignment == 0 || (alignment & (alignment - 1)) != 0) {
+        return NULL;
+    }
+    if (alignment <= ALIGNMENT) {
+        return umalloc(size);
+    }
+    //alloc_block_aligned() looks for room to slide the block up to the alignment,
+    //so the padded size is what the heap would have to supply
+    if (size >= MMAP_THRESHOLD || (size != 0 && (alignment >= MMAP_THRESHOLD ||
+            request_size(size) + alignment + MIN_BLOCK_SIZE >= MMAP_THRESHOLD))) {
+        return large_alloc(size, alignment);
+    }
+    if (size == 0 || size > SIZE_MASK / 2 || alignment > SIZE_MASK / 2 || bind_arena() == NULL) {
+        return NULL;
+    }
+    lock_arena();
+    memory_block_t *mllc = alloc_block_aligned(alignment, request_size(size));
+    unlock_arena();
+    return mllc == NULL ? NULL : get_payload(mllc);
+}
+
+/*
+ * ualigned_alloc - umemalign() with the C11 aligned_alloc() contract: size
+ * must be a multiple of alignment.
+ */
+void *ualigned_alloc(size_t alignment, size_t size) {
+    if (alignment == 0 || size % alignment != 0) {
+        return NULL;
+    }
+    return umemalign(alignment, size);
+}
+
+/*
+ * utrim - consolidates every arena's quick lists, then trims the top of its heap
+ * and purges the pages of all its large free blocks, without waiting for the
+ * trim threshold or decay interval.
+ */
+int utrim(void) {
+    arena_t *self = thread_arena;
+    bool released = false;
+    for (int i = 0; i < num_arenas; i++) {
+        if (!arenas[i].initialized) {
+            continue;
+        }
+        thread_arena = &arenas[i];
+        lock_arena();
+        consolidate();
+        memory_block_t *epilogue = (memory_block_t *)((char *)thread_arena->heap_end - EPILOGUE_SIZE);
+        if (!is_prev_alloc(epilogue)) {
+            memory_block_t *top = prev_block(epilogue);
+            remove_free(top);
+            released |= trim_block(top, 1);
+            push_free(top);
+        }
+        released |= purge_sweep(true);
+        unlock_arena();
+    }
+    thread_arena = self;
+    return released;
+}
+
+/*
+ * umalloc_batch - allocates n blocks of size bytes each, storing their payloads
+ * in out. Each free block found is cut into as many of the blocks as it holds
+ * in a single pass under one acquisition of the arena lock. Returns the number
+ * of blocks allocated, which is less than n only if the heap cannot grow.
+ */
+size_t umalloc_batch(size_t size, size_t n, void **out) {
+    if (size == 0 || size > SIZE_MASK / 2 || bind_arena() == NULL) {
+        return 0;
+    }
+    size_t done = 0;
+    if (size >= MMAP_THRESHOLD) {
+        //every large block is a mapping of its own, there is nothing to carve
+        while (done < n && (out[done] = large_alloc(size, ALIGNMENT)) != NULL) {
+            done++;
+        }
+        return done;
+    }
+    size_t bsize = request_size(size);
+    lock_arena();
+    if (size <= SLAB_MAX_SIZE) {
+        for (void *ptr; done < n && (ptr = slab_alloc(slab_class(size))) != NULL; ) {
+            out[done++] = ptr;
+        }
+    }
+    while (done < n) {
+        //ask for the whole rest of the batch, but no more than extend() can get at once
+        size_t count = n - done;
+        if (count > BATCH_BYTES / bsize) {
+            count = BATCH_BYTES / bsize > 0 ? BATCH_BYTES / bsize : 1;
+        }
+        memory_block_t *block = find(count * bsize);
+        if (block == NULL && count > 1) {
+            block = find(bsize);
+        }
+        if (block == NULL) {
+            break;
+        }
+        size_t total = get_size(block);
+        bool prev_alloc = is_prev_alloc(block);
+        while (done < n && total >= bsize) {
+            size_t take = total - bsize < MIN_BLOCK_SIZE ? total : bsize;
+            put_block(block, take, true, prev_alloc);
+            block->block_size_alloc |= (size_t)thread_arena->id << ARENA_SHIFT;
+            out[done++] = get_payload(block);
+            prev_alloc = true;
+            total -= take;
+            block = next_block(block);
+        }
+        if (total == 0) {
+            set_prev_alloc(block, true);
+        }
+        else {
+            put_block(block, total, false, true);
+            push_free(block);
+        }
+    }
+    unlock_arena();
+    return done;
+}
+
+static int compare_address(const void *a, const void *b) {
+    uintptr_t x = (uintptr_t)*(void * const *)a;
+    uintptr_t y = (uintptr_t)*(void * const *)b;
+    return (x > y) - (x < y);
+}
+
+/*
+ * ufree_batch - frees n payloads, sorting ptrs by address in place. Blocks of
+ * other arenas are handed to their owners. The rest are freed under one
+ * acquisition of the arena lock, with each run of physically adjacent blocks
+ * joined into a single free block before it is coalesced and inserted.
+ */
+void ufree_batch(void **ptrs, size_t n) {
+    if (n == 0 || bind_arena() == NULL) {
+        return;
+    }
+    qsort(ptrs, n, sizeof(void *), compare_address);
+    lock_arena();
+    size_t i = 0;
+    while (i < n) {
+        if (ptrs[i] == NULL) {
+            i++;
+            continue;
+        }
+        span_t *span = page_span(ptrs[i]);
+        if (span != NULL && span->kind == SPAN_LARGE) {
+            large_free(span);
+            i++;
+            continue;
+        }
+        if (span != NULL && span->kind == SPAN_SLAB) {
+            slab_t *run = (slab_t *)span;
+            if (run->span.arena_id == thread_arena->id) {
+                slab_free(run, ptrs[i]);
+            }
+            else {
+                remote_slab_free(&arenas[run->span.arena_id], ptrs[i]);
+            }
+            i++;
+            continue;
+        }
+        memory_block_t *block = get_block(ptrs[i++]);
+        arena_t *owner = get_arena(block);
+        if (owner != thread_arena) {
+            remote_free(owner, block);
+            continue;
+        }
+        size_t total = get_size(block);
+        //a slab object never starts right after a block, its run has a header of its own
+        while (i < n && ptrs[i] != NULL && get_block(ptrs[i]) == (memory_block_t *)((char *)block + total)) {
+            total += get_size(get_block(ptrs[i++]));
+        }
+        put_block(block, total, false, is_prev_alloc(block));
+        set_prev_alloc(next_block(block), false);
+        release_block(coalesce(block));
+    }
+    unlock_arena();
+}
+
+/*
+ * ucalloc - allocates zeroed memory for an array of n elements of size bytes,
+ * or returns NULL if n * size overflows. A block carved from memory that is
+ * still zero from csbrk only needs its free block metadata words cleared;
+ * any other block is cleared in full.
+ */
+void *ucalloc(size_t n, size_t size) {
+    if (size != 0 && n > SIZE_MAX / size) {
+        return NULL;
+    }
+    size_t total = n * size;
+    if (total >= MMAP_THRESHOLD) {
+        //fresh mappings are zero already
+        return large_alloc(total, ALIGNMENT);
+    }
+    if (total == 0 || bind_arena() == NULL) {
+        return NULL;
+    }
+    size_t bsize = request_size(total);
+    if (bsize < TCACHE_MAX_SIZE) {
+        //small blocks come from the thread cache, and are cheap to clear anyway
+        void *payload = umalloc(total);
+        if (payload != NULL) {
+            memset(payload, 0, total);
+        }
+        return payload;
+    }
+    bool zeroed;
+    lock_arena();
+    memory_block_t *mllc = alloc_block(bsize, &zeroed);
+    size_t words = mllc == NULL ? 0 : (get_size(mllc) - HEADER_SIZE) / sizeof(size_t);
+    unlock_arena();
+    if (mllc == NULL) {
+        return NULL;
+    }
+    size_t *payload = get_payload(mllc);
+    if (zeroed) {
+        payload[0] = 0;
+        payload[1] = 0;
+        payload[words - 1] = 0;
+    }
+    else {
+        //the whole payload, slack included, which is a whole number of words
+        memset(payload, 0, words * sizeof(size_t));
+    }
+    return payload;
+}
+
+/*
+ *  STUDENT TODO:
+ *      Describe your free block insertion policy.
+ *      A block owned by another thread's arena is pushed onto that arena's remote free
+ *      stack and freed by its owner later. Slab objects have no header; their slot is
+ *      marked free in the run's bitmap, after a stay in the thread's cache like small
+ *      blocks. Small blocks of our own first go to the freeing thread's cache, whose
+ *      bins are LIFO stacks.
+ *      Otherwise, or when a bin is full and part of it is flushed, the freed block is
+ *      merged with any free neighbors and the result is pushed onto the head of the list
+ *      for its size class (LIFO within a class).
+*/
+
+/*
+ * ufree -  frees the memory space pointed to by ptr, which must have been called
+ * by a previous call to malloc.
+ */
+void ufree(void *ptr) {
+    if (ptr == NULL) {
+        return;
+    }
+    span_t *span = page_span(ptr);
+    if (span != NULL && span->kind == SPAN_SLAB) {
+        slab_cache_free((slab_t *)span, ptr);
+        return;
+    }
+    if (span != NULL && span->kind == SPAN_LARGE) {
+        large_free(span);
+        return;
+    }
+    memory_block_t *block = get_block(ptr);
+    arena_t *owner = get_owner(span, ptr);
+    if (owner != bind_arena()) {
+        remote_free(owner, block);
+        return;
+    }
+    size_t size = load_size(block);
+    if (size < TCACHE_MAX_SIZE) {
+        int bin = get_class(size);
+        if (tcache.counts[bin] >= TCACHE_COUNT) {
+            tcache_flush(bin, TCACHE_BATCH);
+        }
+        tcache_push(bin, block);
+        return;
+    }
+    lock_arena();
+    free_block(block);
+    unlock_arena();
+}
+
+/*
+ * uusable_size - returns the bytes the allocation at ptr can hold: the object
+ * size of a slab run, or the payload of a block including any slack left when
+ * it was not split. All of it may be written, and urealloc() to any size up to
+ * it keeps the allocation where it is.
+ */
+size_t uusable_size(void *ptr) {
+    if (ptr == NULL) {
+        return 0;
+    }
+    slab_t *run = find_slab(ptr);
+    if (run != NULL) {
+        return run->obj_size;
+    }
+    return load_size(get_block(ptr)) - HEADER_SIZE;
+}
+
+/*
+ * ufree_sized - frees ptr, which was allocated with size bytes. The owner comes
+ * from the page map, so a small block of this thread's arena goes into the
+ * tcache without reading its header. Such a block is at most one class larger
+ * than size says (when no split was worth making), which is the slack
+ * tcache_refill() caches blocks with, so its bin is the one for size. A raised
+ * split_min leaves blocks further over size than that, and a block whose slack
+ * could take it to TCACHE_MAX_SIZE may not belong in the tcache at all, so
+ * both are plain ufree(). Debug builds check size against the header.
+ */
+void ufree_sized(void *ptr, size_t size) {
+    if (ptr == NULL) {
+        return;
+    }
+    span_t *span = page_span(ptr);
+    if (span != NULL && span->kind == SPAN_SLAB) {
+        assert(ALIGN(size) <= ((slab_t *)span)->obj_size);
+        slab_cache_free((slab_t *)span, ptr);
+        return;
+    }
+    if (span != NULL && span->kind == SPAN_LARGE) {
+        assert(size <= uusable_size(ptr));
+        large_free(span);
+        return;
+    }
+    size_t bsize = request_size(size);
+    if (split_min > MIN_BLOCK_SIZE || bsize + MIN_BLOCK_SIZE - ALIGNMENT >= TCACHE_MAX_SIZE ||
+            get_owner(span, ptr) != bind_arena()) {
+        ufree(ptr);
+        return;
+    }
+    memory_block_t *block = get_block(ptr);
+#ifdef DEBUG
+    assert(bsize <= load_size(block) && load_size(block) < bsize + MIN_BLOCK_SIZE);
+#endif
+    int bin = get_class(bsize);
+    if (tcache.counts[bin] >= TCACHE_COUNT) {
+        tcache_flush(bin, TCACHE_BATCH);
+    }
+    tcache_push(bin, block);
+}
+
+/*
+ * urealloc - changes the size of the allocation at ptr to size bytes, keeping
+ * its contents up to the smaller of the two sizes. The block is resized in
+ * place when possible; otherwise the contents are copied to a new block. A
+ * size within uusable_size(ptr) returns ptr straight away.
+ */
+void *urealloc(void *ptr, size_t size) {
+    if (ptr == NULL) {
+        return umalloc(size);
+    }
+    if (size == 0) {
+        ufree(ptr);
+        return NULL;
+    }
+    span_t *span = page_span(ptr);
+    if (span != NULL && span->kind != SPAN_REGION) {
+        //slab objects have a fixed size and large blocks keep their mapping as long as
+        //they still fill half of it, otherwise both can only be moved
+        size_t old = uusable_size(ptr);
+        if (size <= old && (span->kind == SPAN_SLAB || size >= old / 2)) {
+            return ptr;
+        }
+        void *payload = umalloc(size);
+        if (payload != NULL) {
+            memcpy(payload, ptr, old < size ? old : size);
+            ufree(ptr);
+        }
+        return payload;
+    }
+    memory_block_t *block = get_block(ptr);
+    size_t bsize = request_size(size);
+    size_t old = load_size(block) - HEADER_SIZE;
+    //growing into the slack uusable_size() reports, or shrinking by too little to split
+    //anything off, leaves the block as it is, so it needs no lock and works for any arena
+    if (bsize <= old + HEADER_SIZE && old + HEADER_SIZE - bsize < MIN_BLOCK_SIZE) {
+        return ptr;
+    }
+    if (size >= MMAP_THRESHOLD || get_arena(block) != bind_arena()) {
+        //a block too large for the arenas, or another arena's block, can only be moved;
+        //the owner frees the old copy
+        void *payload = umalloc(size);
+        if (payload != NULL) {
+            memcpy(payload, ptr, old < size ? old : size);
+            ufree(ptr);
+        }
+        return payload;
+    }
+    lock_arena();
+    memory_block_t *mllc = block;
+    if (!resize_block(block, bsize)) {
+        mllc = alloc_block_low(bsize);
+        if (mllc != NULL) {
+            memcpy(get_payload(mllc), ptr, old < size ? old : size);
+            free_block(block);
+        }
+    }
+    unlock_arena();
+    return mllc == NULL ? NULL : get_payload(mllc);
+}
+
+/*
+ * umallopt - changes an allocator parameter. The placement policy decides which
+ * structure each free block is indexed by and the arenas are laid out by uinit(),
+ * so both can only be changed before uinit() has set up the heap. The growth,
+ * trim, decay and deferred settings are read by every arena without a common
+ * lock, so the same goes for them. Returns 0 on success and -1 otherwise.
+ */
+int umallopt(int param, int value) {
+    if (arenas[0].initialized) {
+        return -1;
+    }
+    switch (param) {
+        case M_FIT_POLICY:
+            if (value < FIT_SEGREGATED || value > FIT_TLSF) {
+                return -1;
+            }
+            fit_policy = value;
+            return 0;
+        case M_ARENAS:
+            if (value < 1 || value > MAX_ARENAS) {
+                return -1;
+            }
+            num_arenas = value;
+            return 0;
+        case M_GROW_QUANTUM:
+            if (value < ALIGNMENT || value > CSBRK_MAX || value % ALIGNMENT != 0) {
+                return -1;
+            }
+            grow_quantum = value;
+            return 0;
+        case M_GROW_GEOMETRIC:
+            if (value != 0 && value != 1) {
+                return -1;
+            }
+            grow_geometric = value;
+            return 0;
+        case M_TRIM_THRESHOLD:
+            if (value < PAGESIZE) {
+                return -1;
+            }
+            trim_threshold = value;
+            return 0;
+        case M_DECAY_MS:
+            if (value < 0) {
+                return -1;
+            }
+            decay_ms = value;
+            return 0;
+        case M_DEFERRED:
+            if (value != 0 && value != 1) {
+                return -1;
+            }
+            deferred = value;
+            return 0;
+        case M_SPLIT_POLICY:
+            if (value < SPLIT_HIGH || value > SPLIT_BY_SIZE) {
+                return -1;
+            }
+            split_policy = value;
+            return 0;
+        case M_SPLIT_MIN:
+            if (value < MIN_BLOCK_SIZE || value % ALIGNMENT != 0) {
+                return -1;
+            }
+            split_min = value;
+            return 0;
+        default:
+            return -1;
+    }
+}
+
+/*
+ * uarena_create - makes an empty region. Its first chunk is only taken when
+ * something is allocated from it.
+ */
+uarena_t *uarena_create(void) {
+    uarena_t *region = umalloc(sizeof(uarena_t));
+    if (region != NULL) {
+        region->chunks = NULL;
+        region->cur = NULL;
+        region->end = NULL;
+    }
+    return region;
+}
+
+/*
+ * uarena_grow - allocates size bytes from a new chunk, which becomes the one
+ * bumped through. A request too big to leave much of a chunk over gets a chunk
+ * of its own instead, linked behind the current one, which stays in use.
+ */
+static void *uarena_grow(uarena_t *region, size_t size) {
+    size_t bytes = sizeof(uarena_chunk_t) + size;
+    bytes = bytes > UARENA_CHUNK_SIZE ? bytes : UARENA_CHUNK_SIZE;
+    uarena_chunk_t *chunk = umalloc(bytes);
+    if (chunk == NULL) {
+        return NULL;
+    }
+    //slack the heap left in the block is bumped through as well
+    chunk->size = uusable_size(chunk);
+    if (size > UARENA_CHUNK_SIZE / 4 && region->chunks != NULL) {
+        chunk->next = region->chunks->next;
+        region->chunks->next = chunk;
+        return chunk + 1;
+    }
+    chunk->next = region->chunks;
+    region->chunks = chunk;
+    region->cur = (char *)(chunk + 1) + size;
+    region->end = (char *)chunk + chunk->size;
+    return chunk + 1;
+}
+
+/*
+ * uarena_alloc - bumps size bytes, rounded up to the alignment, out of the
+ * region's current chunk, taking a new chunk when it runs out.
+ */
+void *uarena_alloc(uarena_t *region, size_t size) {
+    //a size this close to SIZE_MAX would wrap once aligned or given a chunk header
+    if (size == 0 || size > SIZE_MAX - sizeof(uarena_chunk_t) - ALIGNMENT) {
+        return NULL;
+    }
+    size = ALIGN(size);
+    if ((size_t)(region->end - region->cur) >= size) {
+        void *ptr = region->cur;
+        region->cur += size;
+        return ptr;
+    }
+    return uarena_grow(region, size);
+}
+
+/*
+ * uarena_free_chunks - hands a list of chunks back to the heap.
+ */
+static void uarena_free_chunks(uarena_chunk_t *chunk) {
+    while (chunk != NULL) {
+        uarena_chunk_t *next = chunk->next;
+        ufree(chunk);
+        chunk = next;
+    }
+}
+
+/*
+ * uarena_reset - frees every chunk but the current one, which the region
+ * starts bumping through again from the beginning.
+ */
+void uarena_reset(uarena_t *region) {
+    uarena_chunk_t *keep = region->chunks;
+    if (keep == NULL) {
+        return;
+    }
+    uarena_free_chunks(keep->next);
+    keep->next = NULL;
+    region->cur = (char *)(keep + 1);
+}
+
+/*
+ * uarena_destroy - frees every chunk of a region, then the region itself.
+ */
+void uarena_destroy(uarena_t *region) {
+    if (region == NULL) {
+        return;
+    }
+    uarena_free_chunks(region->chunks);
+    ufree(region);
+}
+
+/*
+ * upool_create - sets up an empty pool. Objects are made big enough, and
+ * aligned enough, to hold the free stack link, and slabs are sized to fit at
+ * least UPOOL_MIN_OBJECTS of them. Returns NULL for sizes so large that the
+ * slab size would overflow.
+ */
+upool_t *upool_create(size_t obj_size, size_t align) {
+    if (align == 0 || (align & (align - 1)) != 0) {
+        return NULL;
+    }
+    //past these bounds the object and slab sizes worked out below would wrap
+    size_t most = (SIZE_MAX - ALIGNMENT) / UPOOL_MIN_OBJECTS;
+    if (obj_size > most || align > most) {
+        return NULL;
+    }
+    align = align > sizeof(void *) ? align : sizeof(void *);
+    obj_size = obj_size > sizeof(void *) ? obj_size : sizeof(void *);
+    obj_size = (obj_size + align - 1) & ~(align - 1);
+    if (obj_size > (SIZE_MAX - align) / UPOOL_MIN_OBJECTS) {
+        return NULL;
+    }
+    upool_t *pool = umalloc(sizeof(upool_t));
+    if (pool == NULL) {
+        return NULL;
+    }
+    pool->obj_size = obj_size;
+    pool->align = align;
+    pool->offset = (sizeof(void *) + align - 1) & ~(align - 1);
+    pool->slab_size = pool->offset + UPOOL_MIN_OBJECTS * pool->obj_size;
+    pool->slab_size = pool->slab_size > UPOOL_SLAB_SIZE ? pool->slab_size : UPOOL_SLAB_SIZE;
+    pool->free = NULL;
+    pool->cur = NULL;
+    pool->end = NULL;
+    pool->slabs = NULL;
+    return pool;
+}
+
+/*
+ * upool_grow - takes a new slab from the heap, aligned for the pool's objects,
+ * and hands out its first object. The rest are bumped out of it later.
+ */
+static void *upool_grow(upool_t *pool) {
+    char *slab = pool->align > ALIGNMENT ? umemalign(pool->align, pool->slab_size) : umalloc(pool->slab_size);
+    if (slab == NULL) {
+        return NULL;
+    }
+    *(void **)slab = pool->slabs;
+    pool->slabs = slab;
+    pool->cur = slab + pool->offset + pool->obj_size;
+    pool->end = slab + pool->slab_size;
+    return slab + pool->offset;
+}
+
+/*
+ * upool_alloc - pops the most recently freed object, or failing that bumps
+ * the next one out of the newest slab.
+ */
+void *upool_alloc(upool_t *pool) {
+    void *ptr = pool->free;
+    if (ptr != NULL) {
+        pool->free = *(void **)ptr;
+        return ptr;
+    }
+    if ((size_t)(pool->end - pool->cur) >= pool->obj_size) {
+        ptr = pool->cur;
+        pool->cur += pool->obj_size;
+        return ptr;
+    }
+    return upool_grow(pool);
+}
+
+/*
+ * upool_free - pushes an object onto its pool's free stack.
+ */
+void upool_free(upool_t *pool, void *ptr) {
+    if (ptr == NULL) {
+        return;
+    }
+    *(void **)ptr = pool->free;
+    pool->free = ptr;
+}
+
+/*
+ * upool_destroy - hands every slab of a pool back to the heap, then the pool.
+ */
+void upool_destroy(upool_t *pool) {
+    if (pool == NULL) {
+        return;
+    }
+    void *slab = pool->slabs;
+    while (slab != NULL) {
+        void *next = *(void **)slab;
+        ufree(slab);
+        slab = next;
+    }
+    ufree(pool);
+}
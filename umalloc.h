@@ -1,21 +1,218 @@
 #include <stdlib.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <pthread.h>
 
 #define ALIGNMENT 16 /* The alignment of all payloads returned by umalloc */
 #define ALIGN(size) (((size) + (ALIGNMENT-1)) & ~(ALIGNMENT-1))
 
+#define HEADER_SIZE sizeof(size_t) /* An allocated block carries only its size word */
+#define MIN_BLOCK_SIZE 32 /* Smallest block worth splitting off: a header, two free links and a footer */
+#define EXACT_CLASSES 16  /* Size classes 0-15 each hold a single block size, 32 through 272 */
+#define NUM_CLASSES 24    /* Followed by power of two classes [288, 512), [512, 1K) ... [32K, inf) */
+#define PREV_ALLOC 0x2    /* Header bit set when the block physically before is allocated */
+#define SMALL_CLASS 0x4   /* Header bit set when the block size is one of the exact classes */
+#define EPILOGUE_SIZE HEADER_SIZE /* Zero sized allocated header closing each sbrk region */
+#define PROLOGUE_SIZE HEADER_SIZE /* Same opening each sbrk region, which also puts payloads on 16 byte boundaries */
+#define TREE_MIN_SIZE (MIN_BLOCK_SIZE + EXACT_CLASSES * ALIGNMENT) /* Free blocks from here up go in the best fit tree */
+#define TLSF_SL_BITS 4                    /* log2 of the second level lists per power of two */
+#define TLSF_SL_COUNT (1 << TLSF_SL_BITS)
+#define TLSF_FL_COUNT 64                  /* One first level per bit of a size_t */
+
+#define TCACHE_MAX_SIZE TREE_MIN_SIZE /* Blocks below this size (the exact classes) are cached per thread */
+#define TCACHE_BINS EXACT_CLASSES
+#define TCACHE_COUNT 32   /* Blocks a thread may cache per bin */
+#define TCACHE_BATCH 8    /* Blocks moved between a bin and the heap per lock acquisition */
+
+#define QUICK_MAX_SIZE 1024 /* With M_DEFERRED, blocks below this size are freed onto quick lists */
+#define QUICK_BINS ((QUICK_MAX_SIZE - MIN_BLOCK_SIZE) / ALIGNMENT) /* One LIFO list per block size */
+#define QUICK_LIMIT (64 * 1024) /* Bytes an arena's quick lists hold before they are consolidated */
+
+#define SLAB_MAX_SIZE 64  /* Requests up to this many bytes are served from slabs, without a header */
+#define SLAB_CLASSES (SLAB_MAX_SIZE / ALIGNMENT) /* One slab class per ALIGNMENT bytes */
+#define SLAB_RUN_SIZE 4096 /* Each slab run is a single, page aligned page */
+#define SLAB_BITMAP_WORDS (SLAB_RUN_SIZE / ALIGNMENT / 64)
+#define SLAB_THRESHOLD 64 /* Requests of a class a thread makes before it starts using slabs for it */
+
+#define PAGE_SHIFT 12     /* log2 of the page size the page map is indexed by */
+#define PAGEMAP_BITS 12   /* Page number bits resolved at each of the page map's three levels */
+#define PAGEMAP_FANOUT (1 << PAGEMAP_BITS)
+#define SPAN_REGION 0     /* span_t kinds: an sbrk'd region of an arena */
+#define SPAN_SLAB 1       /* or a slab run inside one */
+#define SPAN_LARGE 2      /* or a single large block with a mapping of its own */
+
+#define MMAP_THRESHOLD (14 * 4096) /* Requests from here up get a mapping of their own, well within csbrk()'s 16 pages */
+#define BATCH_BYTES (8 * 4096) /* Largest free block umalloc_batch() asks for at once, eight pages */
+#define UARENA_CHUNK_SIZE (8 * 4096) /* Bytes a uarena_t takes from the heap at a time */
+#define UPOOL_SLAB_SIZE (4 * 4096) /* Bytes a upool_t takes from the heap at a time */
+#define UPOOL_MIN_OBJECTS 8 /* Objects each pool slab holds at least, for large objects */
+
+#define MAX_ARENAS 64     /* Upper bound on M_ARENAS */
+#define ARENA_SHIFT 56    /* An allocated header keeps its arena's id in the bits from here up */
+#define ZEROED ((size_t)1 << (ARENA_SHIFT - 1)) /* Header bit set while a block's payload is still zero from csbrk */
+#define PURGE_SEEN ((size_t)1 << ARENA_SHIFT) /* Free header bit set when a purge sweep has found the block free */
+#define SIZE_MASK ((ZEROED - 1) & ~(size_t)(ALIGNMENT-1))
+
+/* Parameters and values for umallopt() */
+#define M_FIT_POLICY 1    /* Placement policy, must be set before uinit() */
+#define FIT_SEGREGATED 0  /* First fit within segregated size classes (default) */
+#define FIT_BEST 1        /* Exact classes for small blocks, size ordered tree for the rest */
+#define FIT_TLSF 2        /* Two level segregated fit, O(1) bitmap search */
+#define M_ARENAS 2        /* Number of arenas threads are spread over, must be set before uinit() */
+#define M_GROW_QUANTUM 3  /* The heap grows by multiples of this many bytes (PAGESIZE by default) */
+#define M_GROW_GEOMETRIC 4 /* When 1, each extend of a burst asks for twice as much as the last */
+#define M_TRIM_THRESHOLD 5 /* A free block this large ending at the break is given back (128K by default) */
+#define M_DECAY_MS 6      /* Milliseconds a large free block stays free before its pages are purged (10000 by default) */
+#define M_DEFERRED 7      /* When 1, small blocks are coalesced in bulk rather than as they are freed */
+#define M_SPLIT_POLICY 8  /* Which end of a free block an allocation is carved from */
+#define SPLIT_HIGH 0      /* The high end, the free remainder keeps the low addresses (default) */
+#define SPLIT_LOW 1       /* The low end */
+#define SPLIT_BY_SIZE 2   /* Small blocks (the exact classes) from the high end, larger ones from the low end */
+#define M_SPLIT_MIN 9     /* Smallest remainder split off a free block, smaller ones stay in the allocation */
+
+#define PURGE_MIN_SIZE (4 * 4096) /* Free blocks below this size are never purged */
+#define PURGE_CHECK 64    /* Frees to an arena between looks at the clock */
+
 /*
  * memory_block_t - Represents a block of memory managed by the heap. The 
  * struct can be left as is, or modified for your design.
- * In the current design bit0 is the allocated bit
- * bits 1-3 are unused.
- * and the remaining 60 bit represent the size.
+ * In the current design bit0 is the allocated bit, bit 1 is set when the block
+ * physically before this one is allocated (PREV_ALLOC), bit 2 when the block is
+ * one of the exact size classes (SMALL_CLASS), and the bits from 4 up hold the size.
+ * Only block_size_alloc is a header: HEADER_SIZE bytes, with the payload right
+ * after it, so every block starts 8 bytes past a 16 byte boundary.
+ * next overlays the first payload word and is only meaningful while the block is
+ * free (or parked in a cache), linking it into the free list for its size class.
+ * The matching back link (see get_prev()) is kept in the second payload word.
+ * Free blocks also end in an 8 byte footer that repeats their size, so the
+ * block after them can find their header.
  */
 typedef struct memory_block_struct {
     size_t block_size_alloc;
     struct memory_block_struct *next;
 } memory_block_t;
 
+/*
+ * span_t - A stretch of the heap as the page map sees it. Every page of a
+ * region maps to the region's span, except the pages of slab runs, which map
+ * to the run's own span for as long as the run exists. Regions need not be page
+ * aligned, so the page a region starts in can end another region; it maps to
+ * the later one, which links to the earlier one through below. A large block's
+ * span covers just the block, and sits at the start of the block's own mapping.
+ * A region's span is its descriptor: the region runs from a prologue sentinel
+ * at start to an epilogue sentinel just before end, and next links it to the
+ * arena's region before it.
+ */
+typedef struct span_struct {
+    uintptr_t start;
+    uintptr_t end;        /* One past the last byte */
+    struct span_struct *below; /* Region owning the part of the first page before start, if any */
+    struct span_struct *next;  /* For a region, the arena's previous region */
+    int arena_id;         /* Arena that owns every allocation in the span, 0 for large blocks */
+    int kind;             /* SPAN_REGION, SPAN_SLAB or SPAN_LARGE */
+} span_t;
+
+/*
+ * slab_t - The header at the start of a slab run, a page that holds same size
+ * objects with no header of their own. A set bit in bitmap marks a free slot.
+ * Runs with free slots are kept on their arena's doubly linked list for the
+ * class. The run itself is the payload of an ordinary allocated block, and its
+ * span comes first so a page map lookup can return the run directly.
+ */
+typedef struct slab_struct {
+    span_t span;
+    span_t *region;       /* Span the run's page maps back to when it is released */
+    struct slab_struct *next;
+    struct slab_struct *prev;
+    uint32_t obj_size;
+    uint16_t nslots;
+    uint16_t nfree;
+    uint64_t bitmap[SLAB_BITMAP_WORDS];
+} slab_t;
+
+#define SLAB_HEADER ALIGN(sizeof(slab_t)) /* Offset of the first slot in a run */
+
+/*
+ * tcache_t - A thread's cache of free small blocks, one LIFO stack per exact
+ * size class. Cached blocks stay marked allocated in the heap and are linked
+ * through their next field, so the arena is only touched (under its
+ * lock) to refill an empty bin or flush a full one.
+ */
+typedef struct tcache_struct {
+    memory_block_t *bins[TCACHE_BINS];
+    int counts[TCACHE_BINS];
+    void *slab_bins[SLAB_CLASSES];  /* Free slab objects, linked through their first word */
+    int slab_counts[SLAB_CLASSES];
+    int slab_requests[SLAB_CLASSES]; /* Counts up to SLAB_THRESHOLD */
+    bool registered;
+} tcache_t;
+
+/*
+ * arena_t - An independent heap: its own sbrk'd regions and free structures,
+ * guarded by its own lock. Threads are bound to arenas round robin. A block
+ * freed by a thread of another arena is pushed onto remote_frees, a lock free
+ * stack linked through the block's next field, which the owner drains the next
+ * time it takes its lock.
+ */
+typedef struct arena_struct {
+    pthread_mutex_t lock;
+    memory_block_t *free_lists[NUM_CLASSES];
+    memory_block_t *free_tree;
+    memory_block_t *tlsf_lists[TLSF_FL_COUNT][TLSF_SL_COUNT];
+    uint64_t tlsf_fl_bitmap;
+    uint32_t tlsf_sl_bitmap[TLSF_FL_COUNT];
+    void *heap_end;          /* End of the arena's most recent region */
+    span_t *region;          /* Its span, grown by contiguous extends; older regions follow through next */
+    int grow_streak;         /* Extends since a block was last freed, for M_GROW_GEOMETRIC */
+    unsigned purge_ticks;    /* Frees since the clock was last read */
+    uint64_t purge_time;     /* When the last purge sweep ran, in ms */
+    memory_block_t *quick_lists[QUICK_BINS]; /* Freed blocks still marked allocated, for M_DEFERRED */
+    size_t quick_bytes;      /* Bytes on them */
+    slab_t *slabs[SLAB_CLASSES]; /* Runs with free slots, per slab class */
+    memory_block_t *remote_frees;
+    void *remote_slab_frees; /* Same for slab objects, linked through their first word */
+    int id;
+    bool initialized;
+} arena_t;
+
+/*
+ * uarena_chunk_t - Header of a chunk a uarena_t got from umalloc(), linking it
+ * to the chunk taken before it. 16 bytes, so what follows stays aligned.
+ */
+typedef struct uarena_chunk_struct {
+    struct uarena_chunk_struct *next;
+    size_t size;             /* Bytes of the chunk, header included */
+} uarena_chunk_t;
+
+/*
+ * uarena_t - A region for objects that all die together, unrelated to the
+ * arenas above. Objects are bumped out of the current chunk and never freed one
+ * by one; uarena_reset() and uarena_destroy() give every chunk back at once.
+ * A region must only be used by one thread at a time.
+ */
+typedef struct uarena_struct {
+    uarena_chunk_t *chunks;  /* The chunk being bumped through, then older ones */
+    char *cur;               /* Next free byte of the current chunk */
+    char *end;               /* And its end */
+} uarena_t;
+
+/*
+ * upool_t - A pool of objects of one size and alignment, carved side by side out
+ * of slabs from the heap, without headers. Freed objects go on an intrusive
+ * stack linked through their first word; objects never handed out yet are
+ * bumped out of the newest slab. A pool must only be used by one thread at a time.
+ */
+typedef struct upool_struct {
+    size_t obj_size;         /* Requested size rounded up to the alignment, at least a pointer */
+    size_t align;
+    size_t offset;           /* Where the first object of a slab starts, after its link */
+    size_t slab_size;
+    void *free;              /* Freed objects, linked through their first word */
+    char *cur;               /* Next object of the newest slab never handed out */
+    char *end;               /* And the end of that slab */
+    void *slabs;             /* Every slab, linked through its first word */
+} upool_t;
+
 // Helper Functions, this may be editted if you change the signature in umalloc.c
 
 /*
@@ -40,8 +237,8 @@ void deallocate(memory_block_t *block);
 
 /*Since the least significant bit in block->block_size_alloc is being used to
 * represent whether the block of memory is allocated or not, in order to get the true
-* size this method reverts the 4 least significant bits in block->block_size_alloc to 0
-* and returns the true size of the block of memory.
+* size this method reverts the 4 least significant bits (and the arena id) in block->block_size_alloc
+* to 0 and returns the true size of the block of memory.
 */
 size_t get_size(memory_block_t *block);
 
@@ -50,46 +247,227 @@ size_t get_size(memory_block_t *block);
 */
 memory_block_t *get_next(memory_block_t *block);
 
-/*Sets the size and allocation status of memory block passed by the first parameter,
+/*Returns the block before this one on its free list, or NULL if it is the head.
+* The back link is stored in the second word of a free block's payload, after next.
+*/
+memory_block_t *get_prev(memory_block_t *block);
+
+/*Stores the back link of a free block in the second word of its payload.
+*/
+void set_prev(memory_block_t *block, memory_block_t *prev);
+
+/*Checks the PREV_ALLOC bit, which tells whether the block physically before this one
+* is allocated. If it is not, that block's footer sits right before this header.
+*/
+bool is_prev_alloc(memory_block_t *block);
+
+/*Sets or clears the PREV_ALLOC bit of a block header. Needs to be updated whenever the
+* allocation status of the physically preceding block changes.
+*/
+void set_prev_alloc(memory_block_t *block, bool prev_alloc);
+
+/*Checks the SMALL_CLASS bit, which tells whether a block is one of the exact size classes, the
+* ones the thread cache holds, without masking out its size.
+*/
+bool is_small(memory_block_t *block);
+
+/*Checks the ZEROED bit, set while a block's payload has not been written since csbrk handed it out.
+* Only the free block links in the first two payload words and the footer may be non zero.
+*/
+bool is_zeroed(memory_block_t *block);
+
+/*Sets the ZEROED bit on a block laid out in fresh csbrk memory. Writing the block again with put_block()
+* clears it.
+*/
+void set_zeroed(memory_block_t *block);
+
+/*Sets the size, allocation status and prev allocated bit of memory block passed by the first parameter,
 * and does so at the address in memory *block was specified to before calling the function.
+* The SMALL_CLASS bit follows from the size. Free blocks also get their footer written.
 */
-void put_block(memory_block_t *block, size_t size, bool alloc);
+void put_block(memory_block_t *block, size_t size, bool alloc, bool prev_alloc);
+
+/*Returns the block physically following this one in the heap, found by adding the block size
+* to its address. The zero sized epilogue at the end of every region stops walks from going further.
+*/
+memory_block_t *next_block(memory_block_t *block);
+
+/*Returns the block physically preceding this one, found through the size stored in its footer.
+* May only be called when is_prev_alloc() is false.
+*/
+memory_block_t *prev_block(memory_block_t *block);
 
 /*Returns a void pointer to the payload of a block of memory given the blocks header.
-* Simply adds 1 to memory block to move up 16 bytes in memory.
+* Simply moves up HEADER_SIZE bytes in memory, past the size word.
 */
 void *get_payload(memory_block_t *block);
 
-/*Returns a pointer to a memory block header by casting pointer to the start of the payload
-* to a memory block then subtracting one. This essentially moves the pointer back 16 bytes in memory.
+/*Returns a pointer to a memory block header given the start of its payload, HEADER_SIZE bytes
+* back in memory.
 */
 memory_block_t *get_block(void *payload);
 
-/*Checks if block of memory casted to memory_block_t is really a memory block
-* by checking 4th and 2nd bits to see if they are 1 
+/*Checks if block of memory casted to memory_block_t looks like a real block header: it sits
+* 8 bytes past a 16 byte boundary, the unused bit 3 is clear and SMALL_CLASS agrees with the size.
 */
 bool is_memory_block(memory_block_t *block);
 
-/* Finds and returns the first free head that is large enough to hold size amount
-* of memory.
+/*Returns the index of the segregated free list that a free block of the given
+* size belongs to. Sizes below 272 map to an exact class, larger ones to a power of two class.
+*/
+int get_class(size_t size);
+
+/*Returns the slab class for a request of size bytes, which must be at most SLAB_MAX_SIZE.
+*/
+int slab_class(size_t size);
+
+/*Returns the span that ptr's page belongs to, or NULL if the page is not part of the heap.
+* A constant time walk down the three levels of the page map, which takes no lock.
+*/
+span_t *page_span(void *ptr);
+
+/*Returns the slab run holding ptr, or NULL if ptr is not a slab object. Looks the page up in
+* the page map, so it never reads memory that ptr may not own.
+*/
+slab_t *find_slab(void *ptr);
+
+/*Computes the first and second level TLSF list indices for a free block size: fl is the
+* position of the highest set bit and sl the TLSF_SL_BITS bits below it.
+*/
+void tlsf_mapping(size_t size, int *fl, int *sl);
+
+/*Return the children of a block in the best fit tree, a treap ordered by size and then
+* address. The links are stored in the first two payload words of a free block.
+*/
+memory_block_t *tree_left(memory_block_t *block);
+memory_block_t *tree_right(memory_block_t *block);
+
+/*Pushes a free block onto the front of the free list for its size class, or inserts it
+* into the best fit tree when FIT_BEST is selected and the block is at least TREE_MIN_SIZE.
+*/
+void push_free(memory_block_t *block);
+
+/*Unlinks a free block from the free list for its size class in constant time,
+* using its next and back links, or removes it from the best fit tree in O(log n).
+*/
+void remove_free(memory_block_t *block);
+
+/*Searches the free lists starting at the size class of the request and returns the
+* first block large enough to hold size bytes, already unlinked from its list. Under
+* FIT_BEST the smallest block that fits is returned instead, under FIT_TLSF the head of
+* the first non-empty list whose blocks are all large enough.
 */
 memory_block_t *find(size_t size);
 
-/*When no free block is found with enough space this block block extends the memory heap
-* by adding a new sbrk block. Returns a pointer to the free block header in the memory at the
-* start of the newly created sbrk block.
+/*When no free block is found with enough space this block block extends the memory heap.
+* Memory right after the arena's last region merges with a free block at its end, so only
+* the bytes that block lacks are requested, rounded up to the growth quantum. Returns the
+* resulting free block, which is not on any free list.
 */
 memory_block_t *extend(size_t size);
 
-/*Splits free block into a free and allocated block if malloc request size
-* plus sizeof(memory_block_struct) is less than the size of the original free block that
-* is about to be split.
+/*Splits free block into a free and allocated block if the leftover after taking
+* size bytes is at least MIN_BLOCK_SIZE. The free low part goes back onto its free list
+* and the allocated high part is returned; otherwise the whole block is returned.
 */
 memory_block_t *split(memory_block_t *block, size_t size);
+
+/*Merges an unlinked free block with the free blocks physically before and after it,
+* which are found through the boundary tags, removing those from their lists.
+* Returns the merged block, still unlinked.
+*/
 memory_block_t *coalesce(memory_block_t *block);
 
 
 // Portion that may not be edited
 int uinit();
 void *umalloc(size_t size);
-void ufree(void *ptr);
\ No newline at end of file
+void ufree(void *ptr);
+
+/*Sets an allocator parameter such as M_FIT_POLICY or M_ARENAS. Returns 0 on success or -1 if the
+* parameter or value is not valid, or can no longer be changed.
+*/
+int umallopt(int param, int value);
+
+/*Returns how many bytes the allocation at ptr can actually hold, like malloc_usable_size(). This is
+* more than was asked for when the request was rounded up or a block was not worth splitting; the
+* extra bytes may be used freely, and urealloc() within them never moves the block. Returns 0 for NULL.
+*/
+size_t uusable_size(void *ptr);
+
+/*Frees ptr given the size it was allocated with, as C++14 sized deallocation does. Small blocks
+* go straight to the thread cache bin for that size. Asserts that the size agrees with the header.
+*/
+void ufree_sized(void *ptr, size_t size);
+
+/*Resizes the allocation at ptr to size bytes, keeping its contents. The block grows or shrinks
+* in place when it can and is only moved, copying the contents, as a last resort. Behaves like
+* umalloc() when ptr is NULL and like ufree() when size is 0.
+*/
+void *urealloc(void *ptr, size_t size);
+
+/*Allocates zeroed memory for n elements of size bytes each. Returns NULL if n * size overflows.
+* Memory that is still zero from csbrk is not cleared again.
+*/
+void *ucalloc(size_t n, size_t size);
+
+/*Allocates size bytes at an address that is a multiple of alignment, a power of two. The padding
+* needed to get there is returned to the free structures rather than wasted, and the result is
+* released with ufree(). ualigned_alloc() additionally requires size to be a multiple of alignment.
+*/
+void *umemalign(size_t alignment, size_t size);
+void *ualigned_alloc(size_t alignment, size_t size);
+
+/*Allocates n blocks of size bytes into out, carving several at a time out of one free block.
+* Returns how many were allocated, fewer than n only when the heap cannot grow.
+*/
+size_t umalloc_batch(size_t size, size_t n, void **out);
+
+/*Gives memory back to the kernel right away: the free block at the top of each arena's heap
+* is trimmed by lowering the break, if nothing else is above it, and the whole pages inside
+* every other large free block are purged. Returns 1 if any memory was released, else 0.
+*/
+int utrim(void);
+
+/*Frees n payloads at once. ptrs is sorted by address in place so that neighbouring blocks are
+* merged in a single pass. NULL entries are ignored.
+*/
+void ufree_batch(void **ptrs, size_t n);
+
+/*Creates an empty region, a uarena_t. Allocating from it only bumps a pointer through chunks
+* taken from the heap UARENA_CHUNK_SIZE bytes at a time. Returns NULL if out of memory.
+*/
+uarena_t *uarena_create(void);
+
+/*Allocates size bytes, 16 byte aligned, from a region. The memory is never freed on its own; it
+* lives until the region is reset or destroyed. Returns NULL if size is 0 or out of memory.
+*/
+void *uarena_alloc(uarena_t *region, size_t size);
+
+/*Frees everything allocated from a region at once, handing all but one of its chunks back to the
+* heap, and keeps the region for reuse.
+*/
+void uarena_reset(uarena_t *region);
+
+/*Frees everything allocated from a region along with the region itself. NULL is ignored.
+*/
+void uarena_destroy(uarena_t *region);
+
+/*Creates a pool for objects of obj_size bytes aligned to align, a power of two. Allocating from it
+* pops a free stack, and objects sit densely in slabs of UPOOL_SLAB_SIZE bytes from the heap.
+* Returns NULL if align is not a power of two, if obj_size or align is too large for a slab of
+* UPOOL_MIN_OBJECTS objects to be sized, or out of memory.
+*/
+upool_t *upool_create(size_t obj_size, size_t align);
+
+/*Allocates one object from a pool. Returns NULL if out of memory.
+*/
+void *upool_alloc(upool_t *pool);
+
+/*Returns an object to the pool it was allocated from. NULL is ignored.
+*/
+void upool_free(upool_t *pool, void *ptr);
+
+/*Frees a pool with all of its slabs, whether their objects were freed or not. NULL is ignored.
+*/
+void upool_destroy(upool_t *pool);
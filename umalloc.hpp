@@ -0,0 +1,242 @@
+/*
+ * umalloc.hpp - C++ wrappers over the allocator: a typed object pool, a
+ * std::pmr::memory_resource, a monotonic resource and a std::allocator
+ * compatible template. The namespace is um rather than umalloc, which already
+ * names the allocation function. uinit() must have been called before any of
+ * these allocate.
+ */
+#ifndef UMALLOC_HPP
+#define UMALLOC_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <memory_resource>
+#include <new>
+#include <utility>
+
+extern "C" {
+#include "umalloc.h"
+}
+
+namespace um {
+
+/*
+ * Pool - a typed upool_t for objects of type T. The object size and alignment
+ * are fixed at compile time; allocate() pops the pool's free stack and
+ * construct() builds a T in place on top of it. Throws std::bad_alloc when out
+ * of memory. Like the pool underneath, it must only be used by one thread at
+ * a time.
+ */
+template <typename T>
+class Pool {
+public:
+    static constexpr std::size_t object_size = sizeof(T);
+    static constexpr std::size_t object_align = alignof(T);
+    static_assert((object_align & (object_align - 1)) == 0, "alignment must be a power of two");
+
+    Pool() : pool_(upool_create(object_size, object_align)) {
+        if (pool_ == nullptr) {
+            throw std::bad_alloc();
+        }
+    }
+
+    ~Pool() {
+        upool_destroy(pool_);
+    }
+
+    Pool(const Pool &) = delete;
+    Pool &operator=(const Pool &) = delete;
+
+    /*
+     * allocate - raw, uninitialized storage for one T.
+     */
+    T *allocate() {
+        void *ptr = upool_alloc(pool_);
+        if (ptr == nullptr) {
+            throw std::bad_alloc();
+        }
+        return static_cast<T *>(ptr);
+    }
+
+    /*
+     * deallocate - gives storage from allocate() back without destroying a T.
+     */
+    void deallocate(T *ptr) noexcept {
+        upool_free(pool_, ptr);
+    }
+
+    /*
+     * construct - allocates a T and constructs it from args. The storage goes
+     * back to the pool if the constructor throws.
+     */
+    template <typename... Args>
+    T *construct(Args &&...args) {
+        T *ptr = allocate();
+        try {
+            return ::new (static_cast<void *>(ptr)) T(std::forward<Args>(args)...);
+        }
+        catch (...) {
+            deallocate(ptr);
+            throw;
+        }
+    }
+
+    /*
+     * destroy - runs the destructor of a T from construct() and frees it.
+     * nullptr is ignored.
+     */
+    void destroy(T *ptr) noexcept {
+        if (ptr != nullptr) {
+            ptr->~T();
+            deallocate(ptr);
+        }
+    }
+
+private:
+    upool_t *pool_;
+};
+
+/*
+ * allocate_bytes - umalloc() for C++: alignments above ALIGNMENT go through
+ * umemalign(), zero bytes still get a unique pointer, and failure throws
+ * std::bad_alloc.
+ */
+inline void *allocate_bytes(std::size_t bytes, std::size_t alignment) {
+    bytes = bytes != 0 ? bytes : 1;
+    void *ptr = alignment <= ALIGNMENT ? umalloc(bytes) : umemalign(alignment, bytes);
+    if (ptr == nullptr) {
+        throw std::bad_alloc();
+    }
+    return ptr;
+}
+
+/*
+ * deallocate_bytes - frees memory from allocate_bytes() given the same bytes
+ * and alignment, through the sized path when the block came from umalloc().
+ */
+inline void deallocate_bytes(void *ptr, std::size_t bytes, std::size_t alignment) noexcept {
+    if (alignment <= ALIGNMENT) {
+        ufree_sized(ptr, bytes != 0 ? bytes : 1);
+    }
+    else {
+        ufree(ptr);
+    }
+}
+
+/*
+ * resource - a std::pmr::memory_resource over umalloc()/ufree(). It has no
+ * state, so every instance is equal to every other; get_resource() returns a
+ * shared one, as std::pmr::new_delete_resource() does.
+ */
+class resource final : public std::pmr::memory_resource {
+private:
+    void *do_allocate(std::size_t bytes, std::size_t alignment) override {
+        return allocate_bytes(bytes, alignment);
+    }
+
+    void do_deallocate(void *ptr, std::size_t bytes, std::size_t alignment) override {
+        deallocate_bytes(ptr, bytes, alignment);
+    }
+
+    bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override {
+        return dynamic_cast<const resource *>(&other) != nullptr;
+    }
+};
+
+inline std::pmr::memory_resource *get_resource() noexcept {
+    static resource shared;
+    return &shared;
+}
+
+/*
+ * monotonic_resource - a std::pmr::memory_resource over a uarena_t. Memory is
+ * bumped out of chunks from the heap and deallocate() does nothing; release()
+ * or the destructor gives it all back at once. Not thread safe.
+ */
+class monotonic_resource final : public std::pmr::memory_resource {
+public:
+    monotonic_resource() : region_(uarena_create()) {
+        if (region_ == nullptr) {
+            throw std::bad_alloc();
+        }
+    }
+
+    ~monotonic_resource() override {
+        uarena_destroy(region_);
+    }
+
+    monotonic_resource(const monotonic_resource &) = delete;
+    monotonic_resource &operator=(const monotonic_resource &) = delete;
+
+    /*
+     * release - frees everything allocated from the resource, keeping one
+     * chunk to start over in.
+     */
+    void release() noexcept {
+        uarena_reset(region_);
+    }
+
+private:
+    void *do_allocate(std::size_t bytes, std::size_t alignment) override {
+        //the region only aligns to ALIGNMENT, so more is got by over allocating
+        std::size_t extra = alignment > ALIGNMENT ? alignment - ALIGNMENT : 0;
+        void *ptr = uarena_alloc(region_, (bytes != 0 ? bytes : 1) + extra);
+        if (ptr == nullptr) {
+            throw std::bad_alloc();
+        }
+        if (extra == 0) {
+            return ptr;
+        }
+        return reinterpret_cast<void *>((reinterpret_cast<std::uintptr_t>(ptr) + alignment - 1) & ~(alignment - 1));
+    }
+
+    void do_deallocate(void *, std::size_t, std::size_t) override {
+    }
+
+    bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override {
+        return this == &other;
+    }
+
+    uarena_t *region_;
+};
+
+/*
+ * allocator - a stateless allocator over umalloc() for standard containers, in
+ * place of std::allocator. Over-aligned types go through umemalign().
+ */
+template <typename T>
+class allocator {
+public:
+    using value_type = T;
+
+    allocator() noexcept = default;
+
+    template <typename U>
+    allocator(const allocator<U> &) noexcept {
+    }
+
+    T *allocate(std::size_t n) {
+        if (n > static_cast<std::size_t>(-1) / sizeof(T)) {
+            throw std::bad_array_new_length();
+        }
+        return static_cast<T *>(allocate_bytes(n * sizeof(T), alignof(T)));
+    }
+
+    void deallocate(T *ptr, std::size_t n) noexcept {
+        deallocate_bytes(ptr, n * sizeof(T), alignof(T));
+    }
+};
+
+template <typename T, typename U>
+bool operator==(const allocator<T> &, const allocator<U> &) noexcept {
+    return true;
+}
+
+template <typename T, typename U>
+bool operator!=(const allocator<T> &, const allocator<U> &) noexcept {
+    return false;
+}
+
+} // namespace um
+
+#endif
@@ -1,7 +1,8 @@
+#include "check_heap.h"
 #include "csbrk.h"
 #include "err_handler.h"
 #include "support.h"
-#include "umalloc.h"
+#include <pthread.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -17,10 +18,37 @@
 #define COALESCE 'C'
 #define MAX_LINE_LENGTH 160
 
+/* Operations of the API tests (-a), which run against the real allocator. */
+#define API_OPTION 'O'
+#define API_MALLOC 'A'
+#define API_FREE 'D'
+#define API_CALLOC 'Z'
+#define API_SBRK 'X'
+#define API_MEMALIGN 'M'
+#define API_BATCH 'B'
+#define API_FREE_SIZED 'Q'
+#define API_REALLOC 'R'
+#define API_REGION 'U'
+#define API_POOL 'P'
+#define API_SLAB 'S'
+#define API_MARK 'K'
+#define API_LOWERED 'L'
+#define API_TRIM 'T'
+#define API_PURGE 'Y'
+#define API_REINIT 'I'
+#define API_THREADS 'H'
+#define API_IDS 64
+
 static char printbuf[MAX_LINE_LENGTH];
 static char linebuf[MAX_LINE_LENGTH];
 static int size_offset;
-extern memory_block_t *free_head;
+extern arena_t arenas[MAX_ARENAS];
+extern __thread arena_t *thread_arena;
+extern __thread tcache_t tcache;
+static memory_block_t *free_lists_backup[NUM_CLASSES];
+static bool api_mode;
+static int api_tests, api_failures;
+static void *api_peak;
 
 /* A struct for keeping track of test blocks. */
 typedef struct block_record {
@@ -28,29 +56,69 @@ typedef struct block_record {
     memory_block_t *addr;
 } record_t;
 
+/* A payload handed out during the API tests, filled with its id's pattern. */
+typedef struct api_record {
+    void *ptr;
+    size_t size;
+} api_record_t;
+
+static api_record_t api_records[API_IDS];
+
+/* What the second thread of an H line frees, and the blocks it hands back. */
+typedef struct api_thread {
+    size_t size, n;
+    unsigned char **theirs;
+    unsigned char **ours;
+    arena_t *arena;
+} api_thread_t;
+
 /* Function interfaces */
 static FILE *read_args(int argc, char **argv);
-static void list_add(record_t **record_table, uint32_t id);
-static void list_remove(record_t **record_table, uint32_t id);
-static memory_block_t *initialize_list(void *heap, record_t **record_table, FILE *infile);
+static void initialize_list(void *heap, record_t **record_table, size_t len, FILE *infile);
 static void backup_list(record_t **dest, record_t **source, size_t len);
 static void run_tests(record_t **record_table, record_t **backup, size_t len, FILE *infile);
 
 static void print_block(memory_block_t *block);
 // static void print_records(record_t **record_table, size_t len);
-static void print_list(memory_block_t *free_list);
+static void print_list(void);
 
 static void test_find(size_t size);
 static void test_extend(size_t size);
 static void test_split(record_t **record_table, uint32_t id, size_t size);
 static void test_coalesce(record_t **record_table, uint32_t id);
 
+static int run_api_tests(FILE *infile);
+static void api_result(bool passed, const char *what);
+static bool api_check_payload(void *ptr, size_t size, size_t alignment);
+static bool api_check_pattern(uint32_t id);
+static bool api_check_tcache(void);
+static void api_fill(uint32_t id, void *ptr, size_t size);
+static void test_api_malloc(uint32_t id, size_t size);
+static void test_api_free(uint32_t id);
+static void test_api_calloc(uint32_t id, size_t n, size_t size);
+static void test_api_memalign(uint32_t id, size_t alignment, size_t size);
+static void test_api_batch(size_t size, size_t n);
+static void test_api_free_sized(uint32_t id);
+static void test_api_realloc(uint32_t id, size_t size);
+static void test_api_region(size_t size, size_t n);
+static void test_api_pool(size_t size, size_t alignment, size_t n);
+static void test_api_slab(size_t size, size_t n);
+static void api_note_break(void);
+static void test_api_lowered(bool trim, int lowered);
+static void test_api_purge(size_t size);
+static void test_api_reinit(void);
+static void *api_thread(void *arg);
+static void test_api_threads(size_t size, size_t n);
+
 /* Run all tests */
 int main(int argc, char **argv) {
 
     void *heap = NULL;
     size_offset = 0;
     FILE *infile = read_args(argc, argv);
+    if (api_mode) {
+        return run_api_tests(infile);
+    }
     linebuf[0] = COMMENT;
 
     while (linebuf[0] == COMMENT || linebuf[0] == BLANK) {
@@ -65,8 +133,10 @@ int main(int argc, char **argv) {
 
     record_t **record_table = (record_t **)calloc(num_blocks, sizeof(record_t *));
     record_t **record_table_copy = (record_t **)calloc(num_blocks, sizeof(record_t *));
-    heap = malloc(heap_size);
-    free_head = initialize_list(heap, record_table, infile);
+    heap = malloc(PROLOGUE_SIZE + heap_size);
+    // The helpers work on the calling thread's arena; the tests use the first one
+    thread_arena = &arenas[0];
+    initialize_list(heap, record_table, num_blocks, infile);
 
     for (int i = 0; i < num_blocks; i++) {
         record_table_copy[i] = (record_t *)malloc(sizeof(record_t));
@@ -74,10 +144,11 @@ int main(int argc, char **argv) {
         record_table_copy[i]->addr = (memory_block_t *)malloc(sizeof(memory_block_t));
     }
     backup_list(record_table_copy, record_table, num_blocks);
+    memcpy(free_lists_backup, thread_arena->free_lists, sizeof(free_lists_backup));
     
     sprintf(printbuf, "Initial free list state:");
     logging(LOG_INFO, printbuf);
-    print_list(free_head);
+    print_list();
 
     run_tests(record_table, record_table_copy, num_blocks, infile);
     return EXIT_SUCCESS;
@@ -87,7 +158,7 @@ static FILE *read_args(int argc, char **argv) {
     int option;
     FILE *infile = NULL;
 
-    while ((option = getopt(argc, argv, ":i:s")) != -1) {
+    while ((option = getopt(argc, argv, ":i:sa")) != -1) {
         switch(option) {
             case 'i':
                 if ((infile = fopen(optarg, "r")) == NULL) {
@@ -97,7 +168,10 @@ static FILE *read_args(int argc, char **argv) {
                 }
                 break;
             case 's':
-                size_offset = sizeof(memory_block_t);
+                size_offset = HEADER_SIZE;
+                break;
+            case 'a':
+                api_mode = true;
                 break;
             default:
                 sprintf(printbuf, "Ignoring unknown option %c", optopt);
@@ -113,28 +187,7 @@ static FILE *read_args(int argc, char **argv) {
     return infile;
 }
 
-static void list_add(record_t **record_table, uint32_t id) {
-    memory_block_t *block = NULL;
-    for (int i = 1; i < id; i++) {
-        if (!is_allocated(record_table[i-1]->addr)) {
-            block = record_table[i-1]->addr;
-        }
-    }
-    if (block) block->next = record_table[id-1]->addr;
-}
-
-static void list_remove(record_t **record_table, uint32_t id) {
-    memory_block_t *block = NULL;
-    for (int i = 1; i < id; i++) {
-        if (!is_allocated(record_table[i-1]->addr)) {
-            block = record_table[i-1]->addr;
-        }
-    }
-    if (block) block->next = record_table[id-1]->addr->next;
-}
-
-static memory_block_t *initialize_list(void *heap, record_t **record_table, FILE* infile) {
-    memory_block_t *free_list = NULL;
+static void initialize_list(void *heap, record_t **record_table, size_t len, FILE* infile) {
     char op;
     uint32_t id;
     size_t size;
@@ -160,8 +213,8 @@ static memory_block_t *initialize_list(void *heap, record_t **record_table, FILE
 
         if (id > id_counter) {
             id_counter++;
-            block = (memory_block_t *)(heap + total_size);
-            total_size += size + sizeof(memory_block_t);
+            block = (memory_block_t *)(heap + PROLOGUE_SIZE + total_size);
+            total_size += ALIGN(size + HEADER_SIZE);
             /* ids are 1-indexed. */
             record_table[id-1] = (record_t *)malloc(sizeof(record_t));
             record_table[id-1]->id = id;
@@ -173,12 +226,10 @@ static memory_block_t *initialize_list(void *heap, record_t **record_table, FILE
         
         switch (op) {
             case ALLOC:
-                list_remove(record_table, id);
-                put_block(block, size + size_offset, true);
+                put_block(block, ALIGN(size + size_offset), true, true);
                 break;
             case FREE:
-                list_add(record_table, id);
-                put_block(block, size + size_offset, false);
+                put_block(block, ALIGN(size + size_offset), false, true);
                 break;
             default:
                 break;
@@ -190,12 +241,16 @@ static memory_block_t *initialize_list(void *heap, record_t **record_table, FILE
         }
     }
 
-    free_list = record_table[0]->addr;
-    for (int i = 0; is_allocated(free_list); i++) {
-        free_list = record_table[0]->addr;
+    /* Fill in the prev allocated bits, then link the free blocks into their
+     * size class lists, lowest address first. */
+    for (int i = 1; i < len; i++) {
+        set_prev_alloc(record_table[i]->addr, is_allocated(record_table[i-1]->addr));
+    }
+    for (int i = len; i > 0; i--) {
+        if (!is_allocated(record_table[i-1]->addr)) {
+            push_free(record_table[i-1]->addr);
+        }
     }
-
-    return free_list;
 }
 
 static void backup_list(record_t **dest, record_t **source, size_t len) {
@@ -236,6 +291,7 @@ static void run_tests(record_t **record_table, record_t **backup, size_t len, FI
                 break;
         }
         backup_list(record_table, backup, len);
+        memcpy(thread_arena->free_lists, free_lists_backup, sizeof(free_lists_backup));
 
         if (fgets(linebuf, sizeof(linebuf), infile) == NULL) {
             logging(LOG_FATAL, "Could not read from input file.\n");
@@ -258,10 +314,11 @@ static void print_block(memory_block_t *block) {
 //     }
 // }
 
-static void print_list(memory_block_t *head) {
-    while(head) {
-        print_block(head);
-        head = head->next;
+static void print_list(void) {
+    for (int cls = 0; cls < NUM_CLASSES; cls++) {
+        for (memory_block_t *head = thread_arena->free_lists[cls]; head; head = head->next) {
+            print_block(head);
+        }
     }
     sprintf(printbuf, "End of free list.\n");
     logging(LOG_INFO, printbuf);
@@ -307,6 +364,9 @@ static void test_extend(size_t size) {
 
 static void test_split(record_t **record_table, uint32_t id, size_t size) {
     memory_block_t *block = record_table[id-1]->addr;
+    if (!is_allocated(block)) {
+        remove_free(block);
+    }
     size_t original_size = get_size(block);
     memory_block_t *original_next = block->next;
 
@@ -321,7 +381,7 @@ static void test_split(record_t **record_table, uint32_t id, size_t size) {
         sprintf(printbuf, "Split returned NULL.\n");
         logging(LOG_WARNING, printbuf);
     }
-    else if (original_size <= size+2*sizeof(memory_block_t)-size_offset) {
+    else if (original_size <= size+2*HEADER_SIZE-size_offset) {
         if (get_size(split_block) == original_size && split_block->next == original_next) {
             sprintf(printbuf, "Block was not split.\n");
             logging(LOG_INFO, printbuf);
@@ -342,9 +402,9 @@ static void test_split(record_t **record_table, uint32_t id, size_t size) {
             sprintf(printbuf, "Block was split.");
             logging(LOG_INFO, printbuf);
             size_t alloc_size = get_size(split_block);
-            split_block = (memory_block_t *)((char *)split_block + sizeof(memory_block_t) - size_offset + alloc_size);
+            split_block = (memory_block_t *)((char *)split_block + HEADER_SIZE - size_offset + alloc_size);
             size_t new_size = get_size(split_block);
-            if (alloc_size >= ALIGN(size) && new_size + alloc_size + sizeof(memory_block_t) - size_offset == original_size) {
+            if (alloc_size >= ALIGN(size) && new_size + alloc_size + HEADER_SIZE - size_offset == original_size) {
                 sprintf(printbuf, "New sizes: %ld free, %ld allocated.\n", new_size, alloc_size);
                 logging(LOG_INFO, printbuf);
             }
@@ -359,7 +419,7 @@ static void test_split(record_t **record_table, uint32_t id, size_t size) {
             size_t alloc_size = get_size(split_block);
             split_block = (memory_block_t *)((char *)(split_block) - original_size + alloc_size);
             size_t new_size = get_size(split_block);
-            if (alloc_size >= ALIGN(size) && new_size + alloc_size + sizeof(memory_block_t) - size_offset == original_size) {
+            if (alloc_size >= ALIGN(size) && new_size + alloc_size + HEADER_SIZE - size_offset == original_size) {
                 sprintf(printbuf, "New sizes: %ld free, %ld allocated.", new_size, alloc_size);
                 logging(LOG_INFO, printbuf);
             }
@@ -375,6 +435,9 @@ static void test_split(record_t **record_table, uint32_t id, size_t size) {
 
 static void test_coalesce(record_t **record_table, uint32_t id) {
     memory_block_t *block = record_table[id-1]->addr;
+    if (!is_allocated(block)) {
+        remove_free(block);
+    }
     size_t original_size = get_size(block);
     memory_block_t *original_next = get_next(block);
 
@@ -385,10 +448,10 @@ static void test_coalesce(record_t **record_table, uint32_t id) {
 
     size_t target_size = original_size;
     if (can_coalesce_left) {
-        target_size += get_size(prev) + sizeof(memory_block_t) - size_offset;
+        target_size += get_size(prev) + HEADER_SIZE - size_offset;
     }
     if (can_coalesce_right) {
-        target_size += get_size(next) + sizeof(memory_block_t) - size_offset;
+        target_size += get_size(next) + HEADER_SIZE - size_offset;
     }
 
     sprintf(printbuf, "Testing coalesce on a block with an initial size of %ld:", get_size(block));
@@ -476,4 +539,608 @@ static void test_coalesce(record_t **record_table, uint32_t id) {
             }
         }
     }
-}
\ No newline at end of file
+}
+
+/*
+ * run_api_tests - runs an API test file against the real allocator. Lines up to
+ * the SEPARATOR name umallopt() settings and calls to make; the settings must
+ * come before the first call, which starts the allocator with uinit(). Returns
+ * EXIT_FAILURE if any test failed.
+ */
+static int run_api_tests(FILE *infile) {
+    char op;
+    uint32_t id;
+    size_t size, n, alignment;
+    int param, value;
+    bool started = false;
+
+    while (fgets(linebuf, sizeof(linebuf), infile) != NULL && linebuf[0] != SEPARATOR) {
+        if (linebuf[0] == COMMENT || linebuf[0] == BLANK) {
+            continue;
+        }
+        if (linebuf[0] == API_OPTION) {
+            sscanf(linebuf, "%c %d %d", &op, &param, &value);
+            sprintf(printbuf, "Setting umallopt(%d, %d):", param, value);
+            logging(LOG_INFO, printbuf);
+            api_result(!started && umallopt(param, value) == 0, "umallopt accepted the setting");
+            continue;
+        }
+        if (!started) {
+            if (uinit() == -1) {
+                logging(LOG_FATAL, "uinit failed.\n");
+                exit(EXIT_FAILURE);
+            }
+            started = true;
+        }
+        id = 0;
+        switch (linebuf[0]) {
+            case API_MALLOC:
+            case API_REALLOC:
+                sscanf(linebuf, "%c %d %zu", &op, &id, &size);
+                break;
+            case API_FREE:
+            case API_FREE_SIZED:
+                sscanf(linebuf, "%c %d", &op, &id);
+                break;
+            case API_CALLOC:
+                sscanf(linebuf, "%c %d %zu %zu", &op, &id, &n, &size);
+                break;
+            case API_MEMALIGN:
+                sscanf(linebuf, "%c %d %zu %zu", &op, &id, &alignment, &size);
+                break;
+            case API_BATCH:
+                //batches are freed in the same test, so they need no id
+                sscanf(linebuf, "%c %zu %zu", &op, &size, &n);
+                test_api_batch(size, n);
+                continue;
+            case API_REGION:
+                sscanf(linebuf, "%c %zu %zu", &op, &size, &n);
+                test_api_region(size, n);
+                continue;
+            case API_POOL:
+                sscanf(linebuf, "%c %zu %zu %zu", &op, &size, &alignment, &n);
+                test_api_pool(size, alignment, n);
+                continue;
+            case API_SLAB:
+                sscanf(linebuf, "%c %zu %zu", &op, &size, &n);
+                test_api_slab(size, n);
+                continue;
+            case API_SBRK:
+                //moves the break behind the allocator's back, like the runner does
+                sbrk(PAGESIZE);
+                continue;
+            case API_MARK:
+                api_peak = sbrk(0);
+                continue;
+            case API_LOWERED:
+            case API_TRIM:
+                sscanf(linebuf, "%c %d", &op, &value);
+                test_api_lowered(linebuf[0] == API_TRIM, value);
+                continue;
+            case API_PURGE:
+                sscanf(linebuf, "%c %zu", &op, &size);
+                test_api_purge(size);
+                continue;
+            case API_REINIT:
+                test_api_reinit();
+                continue;
+            case API_THREADS:
+                sscanf(linebuf, "%c %zu %zu", &op, &size, &n);
+                test_api_threads(size, n);
+                continue;
+            default:
+                sprintf(printbuf, "Ignoring unknown API test %c", linebuf[0]);
+                logging(LOG_WARNING, printbuf);
+                continue;
+        }
+        if (id >= API_IDS) {
+            sprintf(printbuf, "API test ids must be below %d", API_IDS);
+            logging(LOG_FATAL, printbuf);
+            exit(EXIT_FAILURE);
+        }
+        switch (linebuf[0]) {
+            case API_MALLOC:
+                test_api_malloc(id, size);
+                break;
+            case API_FREE:
+                test_api_free(id);
+                break;
+            case API_FREE_SIZED:
+                test_api_free_sized(id);
+                break;
+            case API_REALLOC:
+                test_api_realloc(id, size);
+                break;
+            case API_CALLOC:
+                test_api_calloc(id, n, size);
+                break;
+            case API_MEMALIGN:
+                test_api_memalign(id, alignment, size);
+                break;
+        }
+    }
+
+    sprintf(printbuf, "%d of %d API checks failed.\n", api_failures, api_tests);
+    logging(api_failures == 0 ? LOG_INFO : LOG_ERROR, printbuf);
+    return api_failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/*
+ * api_result - counts one check of an API test and logs how it went.
+ */
+static void api_result(bool passed, const char *what) {
+    api_tests++;
+    if (!passed) {
+        api_failures++;
+    }
+    sprintf(printbuf, "%s: %s", passed ? "Passed" : "Failed", what);
+    logging(passed ? LOG_INFO : LOG_ERROR, printbuf);
+}
+
+/*
+ * api_check_payload - checks that a payload is aligned to alignment (at least
+ * ALIGNMENT) and has room for size bytes.
+ */
+static bool api_check_payload(void *ptr, size_t size, size_t alignment) {
+    alignment = alignment > ALIGNMENT ? alignment : ALIGNMENT;
+    return ptr != NULL && (uintptr_t)ptr % alignment == 0 && uusable_size(ptr) >= size;
+}
+
+/*
+ * api_fill - records ptr under id and fills its size bytes with the id's pattern,
+ * so a block that is handed out twice or overwritten shows up when it is checked.
+ */
+static void api_fill(uint32_t id, void *ptr, size_t size) {
+    api_records[id].ptr = ptr;
+    api_records[id].size = size;
+    memset(ptr, 0xa5 ^ id, size);
+}
+
+/*
+ * api_check_pattern - checks that the payload recorded under id still holds the
+ * id's pattern.
+ */
+static bool api_check_pattern(uint32_t id) {
+    unsigned char *bytes = api_records[id].ptr;
+    for (size_t i = 0; i < api_records[id].size; i++) {
+        if (bytes[i] != (unsigned char)(0xa5 ^ id)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+ * api_check_tcache - checks that every block in this thread's cache is no
+ * smaller than its bin's size and short of the next one by less than a block
+ * that could have been split off, so no bin hands out a block far larger than
+ * the requests it serves.
+ */
+static bool api_check_tcache(void) {
+    for (int bin = 0; bin < TCACHE_BINS; bin++) {
+        size_t bin_size = MIN_BLOCK_SIZE + bin * ALIGNMENT;
+        for (memory_block_t *block = tcache.bins[bin]; block != NULL; block = block->next) {
+            if (get_size(block) < bin_size || get_size(block) >= bin_size + MIN_BLOCK_SIZE) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+static void test_api_malloc(uint32_t id, size_t size) {
+    sprintf(printbuf, "Testing umalloc of %zu bytes as id %d:", size, id);
+    logging(LOG_INFO, printbuf);
+    void *ptr = umalloc(size);
+    api_note_break();
+    api_result(api_check_payload(ptr, size, ALIGNMENT), "aligned payload of the requested size");
+    if (ptr != NULL) {
+        api_fill(id, ptr, size);
+    }
+}
+
+static void test_api_free(uint32_t id) {
+    sprintf(printbuf, "Testing ufree of id %d:", id);
+    logging(LOG_INFO, printbuf);
+    api_result(api_check_pattern(id), "payload unchanged since it was written");
+    ufree(api_records[id].ptr);
+    api_records[id].ptr = NULL;
+    api_records[id].size = 0;
+}
+
+/*
+ * test_api_calloc - ucalloc must return NULL when n * size overflows (or is 0),
+ * and otherwise all n * size bytes must read as zero, whether the block was
+ * recycled or still zero from csbrk.
+ */
+static void test_api_calloc(uint32_t id, size_t n, size_t size) {
+    sprintf(printbuf, "Testing ucalloc of %zu * %zu bytes as id %d:", n, size, id);
+    logging(LOG_INFO, printbuf);
+    unsigned char *ptr = ucalloc(n, size);
+    if ((size != 0 && n > SIZE_MAX / size) || n * size == 0) {
+        api_result(ptr == NULL, "NULL for an overflowing or empty request");
+        return;
+    }
+    api_result(api_check_payload(ptr, n * size, ALIGNMENT), "aligned payload of the requested size");
+    if (ptr == NULL) {
+        return;
+    }
+    bool zero = true;
+    for (size_t i = 0; i < n * size; i++) {
+        zero = zero && ptr[i] == 0;
+    }
+    api_result(zero, "payload is all zero");
+    api_fill(id, ptr, n * size);
+}
+
+/*
+ * test_api_memalign - umemalign must return NULL for an alignment that is not a
+ * power of two, and otherwise a payload on a multiple of alignment. A size of 0
+ * may give either NULL or a payload that can be freed.
+ */
+static void test_api_memalign(uint32_t id, size_t alignment, size_t size) {
+    sprintf(printbuf, "Testing umemalign of %zu bytes at %zu as id %d:", size, alignment, id);
+    logging(LOG_INFO, printbuf);
+    void *ptr = umemalign(alignment, size);
+    if (alignment == 0 || (alignment & (alignment - 1)) != 0) {
+        api_result(ptr == NULL, "NULL for an alignment that is not a power of two");
+        return;
+    }
+    if (size == 0) {
+        ufree(ptr);
+        return;
+    }
+    api_result(api_check_payload(ptr, size, alignment), "payload on the alignment, of the requested size");
+    if (ptr != NULL) {
+        api_fill(id, ptr, size);
+    }
+}
+
+/*
+ * test_api_batch - umalloc_batch must hand out all n blocks, each aligned, large
+ * enough and apart from all the others, which ufree_batch then frees.
+ */
+static void test_api_batch(size_t size, size_t n) {
+    sprintf(printbuf, "Testing umalloc_batch of %zu blocks of %zu bytes:", n, size);
+    logging(LOG_INFO, printbuf);
+    void **ptrs = calloc(n, sizeof(void *));
+    size_t got = umalloc_batch(size, n, ptrs);
+    api_note_break();
+    api_result(got == n, "every block was allocated");
+    bool aligned = true;
+    for (size_t i = 0; i < got; i++) {
+        aligned = aligned && api_check_payload(ptrs[i], size, ALIGNMENT);
+        if (ptrs[i] != NULL) {
+            memset(ptrs[i], (int)(i & 0xff), size);
+        }
+    }
+    api_result(aligned, "aligned payloads of the requested size");
+    //a block that overlaps another has had its pattern overwritten
+    bool apart = true;
+    for (size_t i = 0; i < got && aligned; i++) {
+        unsigned char *bytes = ptrs[i];
+        for (size_t j = 0; j < size; j++) {
+            apart = apart && bytes[j] == (unsigned char)(i & 0xff);
+        }
+    }
+    api_result(apart, "no two blocks overlap");
+    ufree_batch(ptrs, got);
+    free(ptrs);
+}
+
+/*
+ * test_api_slab - makes n umalloc(size) calls for a size up to SLAB_MAX_SIZE.
+ * Once this thread has made SLAB_THRESHOLD requests of the class, each object
+ * must come from a slab run and have the class size as its uusable_size();
+ * until then each must be an ordinary block. The objects must not overlap,
+ * and are then handed back with ufree.
+ */
+static void test_api_slab(size_t size, size_t n) {
+    sprintf(printbuf, "Testing umalloc of %zu slab sized objects of %zu bytes:", n, size);
+    logging(LOG_INFO, printbuf);
+    int cls = slab_class(size);
+    unsigned char **objs = calloc(n, sizeof(unsigned char *));
+    bool placed = true;
+    for (size_t i = 0; i < n; i++) {
+        bool slab = tcache.slab_requests[cls] >= SLAB_THRESHOLD;
+        objs[i] = umalloc(size);
+        placed = placed && api_check_payload(objs[i], size, ALIGNMENT) && (find_slab(objs[i]) != NULL) == slab &&
+                 (!slab || uusable_size(objs[i]) == ALIGN(size));
+        if (objs[i] != NULL) {
+            memset(objs[i], (int)(i & 0xff), size);
+        }
+    }
+    api_result(placed, "slab objects of the class size past SLAB_THRESHOLD, blocks before");
+    bool apart = true;
+    for (size_t i = 0; i < n && placed; i++) {
+        for (size_t j = 0; j < size; j++) {
+            apart = apart && objs[i][j] == (unsigned char)(i & 0xff);
+        }
+    }
+    api_result(apart, "no two objects overlap");
+    for (size_t i = 0; i < n; i++) {
+        ufree(objs[i]);
+    }
+    free(objs);
+}
+
+/*
+ * test_api_free_sized - frees id with ufree_sized, given the size it was
+ * allocated with. The asserts in ufree_sized check the size against the block.
+ */
+static void test_api_free_sized(uint32_t id) {
+    sprintf(printbuf, "Testing ufree_sized of id %d, %zu bytes:", id, api_records[id].size);
+    logging(LOG_INFO, printbuf);
+    api_result(api_check_pattern(id), "payload unchanged since it was written");
+    ufree_sized(api_records[id].ptr, api_records[id].size);
+    api_records[id].ptr = NULL;
+    api_records[id].size = 0;
+    api_result(api_check_tcache(), "cached blocks fit their bins");
+}
+
+/*
+ * test_api_realloc - urealloc must keep as much of the payload as fits in the
+ * new size, wherever the block ends up.
+ */
+static void test_api_realloc(uint32_t id, size_t size) {
+    sprintf(printbuf, "Testing urealloc of id %d from %zu to %zu bytes:", id, api_records[id].size, size);
+    logging(LOG_INFO, printbuf);
+    void *ptr = urealloc(api_records[id].ptr, size);
+    api_result(api_check_payload(ptr, size, ALIGNMENT), "aligned payload of the requested size");
+    if (ptr == NULL) {
+        return;
+    }
+    api_records[id].ptr = ptr;
+    api_records[id].size = api_records[id].size < size ? api_records[id].size : size;
+    api_result(api_check_pattern(id), "payload kept up to the smaller size");
+    api_fill(id, ptr, size);
+}
+
+/*
+ * test_api_region - bumps n objects of size bytes out of a fresh uarena_t,
+ * checks that they are aligned and apart, then resets the region and does it
+ * again. A size no chunk could hold must give NULL, without disturbing the
+ * region for the next small object.
+ */
+static void test_api_region(size_t size, size_t n) {
+    sprintf(printbuf, "Testing uarena_alloc of %zu objects of %zu bytes:", n, size);
+    logging(LOG_INFO, printbuf);
+    uarena_t *region = uarena_create();
+    api_result(region != NULL, "region created");
+    if (region == NULL) {
+        return;
+    }
+    if (size > SIZE_MAX - UARENA_CHUNK_SIZE) {
+        api_result(uarena_alloc(region, size) == NULL, "NULL for a size no chunk can hold");
+        unsigned char *first = uarena_alloc(region, 16);
+        unsigned char *second = uarena_alloc(region, 16);
+        api_result(first != NULL && second == first + 16, "small objects still bumped from one chunk");
+        uarena_destroy(region);
+        return;
+    }
+    for (int round = 0; round < 2; round++) {
+        unsigned char **objs = calloc(n, sizeof(unsigned char *));
+        bool fine = true;
+        for (size_t i = 0; i < n; i++) {
+            objs[i] = uarena_alloc(region, size);
+            fine = fine && objs[i] != NULL && (uintptr_t)objs[i] % ALIGNMENT == 0;
+            if (objs[i] != NULL) {
+                memset(objs[i], (int)(i & 0xff), size);
+            }
+        }
+        for (size_t i = 0; i < n && fine; i++) {
+            for (size_t j = 0; j < size; j++) {
+                fine = fine && objs[i][j] == (unsigned char)(i & 0xff);
+            }
+        }
+        api_result(fine, round == 0 ? "aligned objects that do not overlap" : "the same after a reset");
+        free(objs);
+        uarena_reset(region);
+    }
+    uarena_destroy(region);
+}
+
+/*
+ * test_api_pool - takes n objects from a new upool_t, checks that they are
+ * aligned and apart, then frees every other one and takes them again. A pool
+ * whose slab size would overflow must not be created.
+ */
+static void test_api_pool(size_t size, size_t alignment, size_t n) {
+    sprintf(printbuf, "Testing upool_alloc of %zu objects of %zu bytes at %zu:", n, size, alignment);
+    logging(LOG_INFO, printbuf);
+    upool_t *pool = upool_create(size, alignment);
+    if (size > (SIZE_MAX - ALIGNMENT) / UPOOL_MIN_OBJECTS || alignment > (SIZE_MAX - ALIGNMENT) / UPOOL_MIN_OBJECTS) {
+        api_result(pool == NULL, "NULL for sizes no slab can be sized for");
+        upool_destroy(pool);
+        return;
+    }
+    api_result(pool != NULL, "pool created");
+    if (pool == NULL) {
+        return;
+    }
+    unsigned char **objs = calloc(n, sizeof(unsigned char *));
+    for (int round = 0; round < 2; round++) {
+        bool fine = true;
+        for (size_t i = round; i < n; i += round + 1) {
+            objs[i] = upool_alloc(pool);
+            fine = fine && objs[i] != NULL && (uintptr_t)objs[i] % alignment == 0;
+            if (objs[i] != NULL) {
+                memset(objs[i], (int)(i & 0xff), size);
+            }
+        }
+        for (size_t i = 0; i < n && fine; i++) {
+            for (size_t j = 0; j < size; j++) {
+                fine = fine && objs[i][j] == (unsigned char)(i & 0xff);
+            }
+        }
+        api_result(fine, round == 0 ? "aligned objects that do not overlap" : "the same after freeing every other one");
+        for (size_t i = 1; i < n && round == 0; i += 2) {
+            upool_free(pool, objs[i]);
+        }
+    }
+    free(objs);
+    upool_destroy(pool);
+}
+
+/*
+ * api_note_break - keeps api_peak at the highest break seen since the last K
+ * line, so that L and T lines can tell whether memory went back.
+ */
+static void api_note_break(void) {
+    if ((char *)sbrk(0) > (char *)api_peak) {
+        api_peak = sbrk(0);
+    }
+}
+
+/*
+ * test_api_lowered - checks that the break is below (lowered is 1) or not below
+ * (0) the highest it reached since the last K line. With trim set, utrim() is
+ * called first and the check is against the break just before it instead, and
+ * a utrim() that lowers the break must also say it released memory.
+ */
+static void test_api_lowered(bool trim, int lowered) {
+    sprintf(printbuf, "Testing that the break %s%s:", lowered ? "came down" : "stayed", trim ? " over utrim" : "");
+    logging(LOG_INFO, printbuf);
+    char *before = trim ? sbrk(0) : api_peak;
+    int released = trim ? utrim() : 0;
+    bool below = (char *)sbrk(0) < before;
+    api_result(below == (lowered != 0), lowered ? "the break is lower" : "the break is not lower");
+    if (trim && below) {
+        api_result(released == 1, "utrim reported the release");
+    }
+}
+
+/*
+ * test_api_purge - frees a block of size bytes (at least PURGE_MIN_SIZE), then
+ * makes 2 * PURGE_CHECK more frees. With M_DECAY_MS at 0 each PURGE_CHECK
+ * frees sweep the arena, so the first sweep must mark the free block PURGE_SEEN
+ * and the second must purge it, leaving it ZEROED with a payload that reads as
+ * zero. ucalloc of the size must then hand back zeroed memory.
+ */
+static void test_api_purge(size_t size) {
+    sprintf(printbuf, "Testing the purge of a free block of %zu bytes:", size);
+    logging(LOG_INFO, printbuf);
+    //blocks this size skip the tcache, so each free reaches the arena
+    void *ticks[2 * PURGE_CHECK];
+    for (int i = 0; i < 2 * PURGE_CHECK; i++) {
+        ticks[i] = umalloc(TCACHE_MAX_SIZE);
+    }
+    //the block gets a region of its own, away from the ticks, and is not trimmed
+    sbrk(PAGESIZE);
+    unsigned char *ptr = umalloc(size);
+    sbrk(PAGESIZE);
+    memset(ptr, 0xa5, size);
+    memory_block_t *block = get_block(ptr);
+    memory_block_t *free_block = is_prev_alloc(block) ? block : prev_block(block);
+    ufree(ptr);
+    size_t bsize = get_size(free_block);
+    for (int i = 0; i < PURGE_CHECK; i++) {
+        ufree(ticks[i]);
+    }
+    api_result((free_block->block_size_alloc & PURGE_SEEN) != 0, "PURGE_SEEN after the first sweep");
+    for (int i = PURGE_CHECK; i < 2 * PURGE_CHECK; i++) {
+        ufree(ticks[i]);
+    }
+    bool zero = get_size(free_block) == bsize && is_zeroed(free_block) && !(free_block->block_size_alloc & PURGE_SEEN);
+    //the header, the two free links and the footer stay in place
+    unsigned char *end = (unsigned char *)free_block + bsize - sizeof(size_t);
+    for (unsigned char *byte = get_payload(free_block) + 2 * sizeof(void *); zero && byte < end; byte++) {
+        zero = *byte == 0;
+    }
+    api_result(zero, "ZEROED, with a zero payload, after the second");
+    unsigned char *again = ucalloc(1, size);
+    bool clear = again != NULL;
+    for (size_t i = 0; clear && i < size; i++) {
+        clear = again[i] == 0;
+    }
+    api_result(clear, "ucalloc handed the memory back zeroed");
+    ufree(again);
+}
+
+/*
+ * test_api_reinit - calls uinit() again, which discards the heap and every id
+ * still held in it. This thread's cache must be left empty, with its slab
+ * request counts back at zero, and the next small blocks must come from the
+ * new heap, above where the old one ended.
+ */
+static void test_api_reinit(void) {
+    logging(LOG_INFO, "Testing a second uinit:");
+    char *old_end = arenas[0].heap_end;
+    api_result(uinit() == 0, "uinit succeeded");
+    memset(api_records, 0, sizeof(api_records));
+    bool empty = true;
+    for (int bin = 0; bin < TCACHE_BINS; bin++) {
+        empty = empty && tcache.bins[bin] == NULL && tcache.counts[bin] == 0;
+    }
+    for (int cls = 0; cls < SLAB_CLASSES; cls++) {
+        empty = empty && tcache.slab_bins[cls] == NULL && tcache.slab_counts[cls] == 0 &&
+                tcache.slab_requests[cls] == 0;
+    }
+    api_result(empty, "the thread's cache is empty");
+    char *block = umalloc(100);
+    char *object = umalloc(10);
+    api_result(block > old_end && object > old_end, "small blocks come from the new heap");
+    ufree(block);
+    ufree(object);
+}
+
+/*
+ * api_thread - frees every block of theirs, which another thread allocated,
+ * then allocates n blocks of its own, filled with their index, for the other
+ * thread to free once this one has exited.
+ */
+static void *api_thread(void *arg) {
+    api_thread_t *work = arg;
+    for (size_t i = 0; i < work->n; i++) {
+        ufree(work->theirs[i]);
+    }
+    for (size_t i = 0; i < work->n; i++) {
+        work->ours[i] = umalloc(work->size);
+        if (work->ours[i] != NULL) {
+            memset(work->ours[i], (int)(i & 0xff), work->size);
+        }
+    }
+    work->arena = thread_arena;
+    return NULL;
+}
+
+/*
+ * test_api_threads - allocates n blocks of size bytes on this thread and has a
+ * second thread, bound to another arena, free them and allocate n of its own,
+ * which this thread then frees. Each side's frees must wait on the owner's
+ * remote lists until the owner takes its lock, after which check_heap() must
+ * find every arena consistent. Threads are bound round robin, so each call
+ * needs an arena this thread does not have left over.
+ */
+static void test_api_threads(size_t size, size_t n) {
+    sprintf(printbuf, "Testing %zu blocks of %zu bytes freed by another thread:", n, size);
+    logging(LOG_INFO, printbuf);
+    api_thread_t work = {size, n, calloc(n, sizeof(unsigned char *)), calloc(n, sizeof(unsigned char *)), NULL};
+    for (size_t i = 0; i < n; i++) {
+        work.theirs[i] = umalloc(size);
+    }
+    pthread_t thread;
+    pthread_create(&thread, NULL, api_thread, &work);
+    pthread_join(thread, NULL);
+    arena_t *owner = thread_arena;
+    api_result(work.arena != NULL && work.arena != owner, "the other thread was bound to another arena");
+    api_result(owner->remote_frees != NULL || owner->remote_slab_frees != NULL,
+               "the other thread's frees wait for this thread's arena");
+    bool intact = true;
+    for (size_t i = 0; i < n; i++) {
+        intact = intact && work.ours[i] != NULL;
+        for (size_t j = 0; intact && j < size; j++) {
+            intact = work.ours[i][j] == (unsigned char)(i & 0xff);
+        }
+        ufree(work.ours[i]);
+    }
+    api_result(intact, "the other thread's blocks arrived intact");
+    //a block too large for the thread's cache takes the arena lock, and drains
+    ufree(umalloc(TCACHE_MAX_SIZE));
+    api_result(owner->remote_frees == NULL && owner->remote_slab_frees == NULL, "the owner drained them");
+    //utrim() takes every arena's lock in turn, the other thread's too
+    utrim();
+    api_result(check_heap() == 0, "check_heap found every arena consistent");
+    free(work.theirs);
+    free(work.ours);
+}